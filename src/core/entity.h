@@ -32,10 +32,10 @@ public:
 	{}
 	virtual ~Entity() {}
 
-	string getName() const { return name; }
+	const string& getName() const { return name; }
 	void setName(string n) { name = n; }
 
-	virtual string getLongName() const { return name; }
+	virtual const string& getLongName() const { return name; }
 
 
 };
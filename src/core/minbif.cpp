@@ -61,6 +61,9 @@ Minbif::Minbif()
 	section->AddItem(new ConfigItem_string("password", "Global server password", " "));
 	section->AddItem(new ConfigItem_int("type", "Type of daemon", 0, 2, "0"));
 	section->AddItem(new ConfigItem_int("ping", "Ping frequence (s)", 0, 65535, "60"));
+	section->AddItem(new ConfigItem_int("who_max_results", "Maximum number of replies to a WHO on a mask (0 = unlimited)", 0, 65535, "1000"));
+	section->AddItem(new ConfigItem_int("presence_delay", "Coalesce buddy presence changes during this delay (ms)", 0, 65535, "1000"));
+	section->AddItem(new ConfigItem_int("reconnect_grace", "Keep buddies of a disconnected account during this delay (s)", 0, 65535, "30"));
 	section->AddItem(new ConfigItem_string("buddy_icons_url", "URL to display in /WHOIS to get a buddy icon", " "));
 
 	sub = section->AddSection("inetd", "Inetd information", MyConfig::OPTIONAL);
@@ -71,6 +74,8 @@ Minbif::Minbif()
 	sub->AddItem(new ConfigItem_int("port", "Port to listen on", 1, 65535), true);
 	sub->AddItem(new ConfigItem_bool("background", "Start minbif in background", "true"));
 	sub->AddItem(new ConfigItem_int("maxcon", "Maximum simultaneous connections", 0, 65535, "0"));
+	sub->AddItem(new ConfigItem_int("prefork", "Number of idle processes waiting for connections", 0, 65535, "0"));
+	sub->AddItem(new ConfigItem_bool("preload_plugins", "Load libpurple plugins once before forking", "false"));
 	add_server_block_common_params(sub);
 
 	sub = section->AddSection("oper", "Define an IRC operator", MyConfig::MULTIPLE);
@@ -102,13 +107,20 @@ Minbif::Minbif()
 void Minbif::add_server_block_common_params(ConfigSection* section)
 {
 	section->AddItem(new ConfigItem_string("security", "none/tls/starttls/starttls-mandatory", "none"));
+	section->AddItem(new ConfigItem_int("sendq_low", "Resume reading a client when its send queue is below this size (KB)", 0, 1048576, "64"));
+	section->AddItem(new ConfigItem_int("sendq_high", "Stop reading a client when its send queue is above this size (KB)", 0, 1048576, "256"));
+	section->AddItem(new ConfigItem_int("sendq_max", "Disconnect a client when its send queue exceeds this size (KB)", 1, 1048576, "4096"));
 #ifdef HAVE_TLS
 	ConfigSection* sub = section->AddSection("tls", "TLS information", MyConfig::OPTIONAL);
 	sub->AddItem(new ConfigItem_string("trust_file", "CA certificate file for TLS", " "));
 	sub->AddItem(new ConfigItem_string("crl_file", "CA certificate file for TLS", " "));
 	sub->AddItem(new ConfigItem_string("cert_file", "Server certificate file for TLS"));
 	sub->AddItem(new ConfigItem_string("key_file", "Server key file for TLS"));
+	sub->AddItem(new ConfigItem_string("dh_params_file", "DH parameters file (PKCS#3 PEM) instead of generating them", " "));
 	sub->AddItem(new ConfigItem_string("priority", "Priority list for ciphers, exchange methods, macs and compression methods", "NORMAL"));
+	sub->AddItem(new ConfigItem_int("handshake_timeout", "Seconds allowed to complete the TLS handshake", 0, 3600, "30"));
+	sub->AddItem(new ConfigItem_bool("session_tickets", "Let clients resume sessions with tickets", "true"));
+	sub->AddItem(new ConfigItem_int("ticket_key_lifetime", "Seconds before the session ticket key is replaced (0 = only on rehash)", 0, 604800, "3600"));
 #endif
 }
 
@@ -23,8 +23,11 @@
 #include <sys/unistd.h>
 #include <string>
 #include <cstdarg>
+#include <cstdlib>
+#include <stdint.h>
 
 #include "util.h"
+#include "log.h"
 
 string stringtok(string &in, const char * const delimiters)
 {
@@ -122,6 +125,113 @@ string strlower(string s)
 	return s;
 }
 
+const unsigned char rfc1459_lower_table[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	/* '@', 'A'..'Z' -> 'a'..'z', '[' -> '{', '\\' -> '|', ']' -> '}', '^', '_' */
+	0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x5e, 0x5f,
+	/* '~' -> '^' */
+	0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x5e, 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+};
+
+string rfc1459_strlower(string s)
+{
+	for(string::iterator it = s.begin(); it != s.end(); ++it)
+		*it = rfc1459_tolower(*it);
+	return s;
+}
+
+size_t rfc1459_hash::operator()(const string& s) const
+{
+	/* FNV-1a on the folded characters. */
+	size_t h = 2166136261U;
+	for(string::const_iterator it = s.begin(); it != s.end(); ++it)
+	{
+		h ^= (unsigned char)rfc1459_tolower(*it);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+bool rfc1459_equal::operator()(const string& a, const string& b) const
+{
+	if(a.size() != b.size())
+		return false;
+
+	for(string::size_type i = 0; i < a.size(); ++i)
+		if(rfc1459_tolower(a[i]) != rfc1459_tolower(b[i]))
+			return false;
+	return true;
+}
+
+MaskMatcher::MaskMatcher(const string& pattern)
+	: wildcard(false)
+{
+	string::size_type first = pattern.find('*');
+	if(first == string::npos)
+	{
+		prefix = rfc1459_strlower(pattern);
+		return;
+	}
+
+	wildcard = true;
+	string::size_type last = pattern.rfind('*');
+	prefix = rfc1459_strlower(pattern.substr(0, first));
+	suffix = rfc1459_strlower(pattern.substr(last + 1));
+
+	for(string::size_type pos = first + 1; pos <= last; )
+	{
+		string::size_type next = pattern.find('*', pos);
+		if(next > pos)
+			middle.push_back(rfc1459_strlower(pattern.substr(pos, next - pos)));
+		pos = next + 1;
+	}
+}
+
+bool MaskMatcher::matchAt(const string& segment, const char* s)
+{
+	for(string::size_type i = 0; i < segment.size(); ++i)
+		if(segment[i] != '?' && segment[i] != rfc1459_tolower(s[i]))
+			return false;
+	return true;
+}
+
+bool MaskMatcher::match(const string& s) const
+{
+	if(!wildcard)
+		return s.size() == prefix.size() && matchAt(prefix, s.data());
+
+	if(s.size() < prefix.size() + suffix.size() ||
+	   !matchAt(prefix, s.data()) ||
+	   !matchAt(suffix, s.data() + s.size() - suffix.size()))
+		return false;
+
+	/* Leftmost match of each segment between the first and last '*'. */
+	string::size_type pos = prefix.size();
+	string::size_type end = s.size() - suffix.size();
+	for(std::vector<string>::const_iterator it = middle.begin(); it != middle.end(); ++it)
+	{
+		while(pos + it->size() <= end && !matchAt(*it, s.data() + pos))
+			++pos;
+		if(pos + it->size() > end)
+			return false;
+		pos += it->size();
+	}
+	return true;
+}
+
 bool is_ip(const char *ip)
 {
 	char *ptr = NULL;
@@ -303,6 +413,66 @@ gchar* irc2markup(const gchar* string)
 	return g_string_free(decoded, FALSE);
 }
 
+size_t StaticStringIndex::slot(const char* s, unsigned _seed) const
+{
+	uint32_t h = 2166136261u ^ _seed;
+	for(; *s; ++s)
+	{
+		h ^= (unsigned char)*s;
+		h *= 16777619u;
+	}
+	h ^= h >> 15;
+	return h & mask;
+}
+
+void StaticStringIndex::build(const std::vector<const char*>& _names)
+{
+	names = _names;
+
+	/* No seed can ever separate two equal strings. */
+	for(size_t i = 0; i < names.size(); ++i)
+		for(size_t j = i + 1; j < names.size(); ++j)
+			if(!strcmp(names[i], names[j]))
+			{
+				b_log[W_ERR] << "Duplicate entry '" << names[i] << "' in a static string table";
+				abort();
+			}
+
+	for(size_t size = 16; ; size <<= 1)
+	{
+		if(size < names.size() * 2)
+			continue;
+
+		mask = size - 1;
+		for(seed = 0; seed < 1024; ++seed)
+		{
+			slots.assign(size, -1);
+
+			size_t i;
+			for(i = 0; i < names.size(); ++i)
+			{
+				int& s = slots[slot(names[i], seed)];
+				if(s >= 0)
+					break;
+				s = (int)i;
+			}
+			if(i == names.size())
+				return;
+		}
+	}
+}
+
+int StaticStringIndex::find(const char* s) const
+{
+	if(names.empty())
+		return -1;
+
+	int i = slots[slot(s, seed)];
+	if(i < 0 || strcmp(names[i], s))
+		return -1;
+	return i;
+}
+
 gchar* markup2irc(const gchar* markup)
 {
 	char* newline = purple_strdup_withhtml(markup);
@@ -20,7 +20,10 @@
 
 #include <purple.h>
 #include <string>
+#include <vector>
+#include <list>
 #include <sstream>
+#include <tr1/unordered_map>
 using std::string;
 
 string stringtok(string &in, const char * const delimiters);
@@ -52,6 +55,140 @@ guint glib_input_add(gint fd, PurpleInputCondition condition, PurpleInputFunctio
 string strupper(string s);
 string strlower(string s);
 
+/** Table used to lower a character with the RFC1459 casemapping.
+ *
+ * In addition to ASCII letters, '[', ']', '\\' and '~' are the
+ * uppercase versions of '{', '}', '|' and '^'.
+ */
+extern const unsigned char rfc1459_lower_table[256];
+
+static inline char rfc1459_tolower(char c) { return (char)rfc1459_lower_table[(unsigned char)c]; }
+
+/** Lower a string with the RFC1459 casemapping. */
+string rfc1459_strlower(string s);
+
+/** Hash functor for case-insensitive (RFC1459) string keys.
+ *
+ * It folds characters on the fly, so looking up a key never
+ * allocates a temporary lowered string.
+ */
+struct rfc1459_hash
+{
+	size_t operator()(const string& s) const;
+};
+
+/** Equality functor for case-insensitive (RFC1459) string keys. */
+struct rfc1459_equal
+{
+	bool operator()(const string& a, const string& b) const;
+};
+
+/** Perfect hash index of a static table of strings.
+ *
+ * build() looks for a seed for which every string has its own slot, so
+ * a lookup costs one hash and one strcmp().
+ */
+class StaticStringIndex
+{
+	std::vector<const char*> names;
+	std::vector<int> slots;
+	unsigned seed;
+	size_t mask;
+
+	size_t slot(const char* s, unsigned seed) const;
+
+public:
+	StaticStringIndex() : seed(0), mask(0) {}
+
+	bool empty() const { return names.empty(); }
+
+	/** Build the index.
+	 *
+	 * @param names  strings to index. They must live as long as the index,
+	 *               and be distinct (the process aborts otherwise).
+	 */
+	void build(const std::vector<const char*>& names);
+
+	/** Find a string.
+	 *
+	 * @return  its position in the vector given to build(), or -1.
+	 */
+	int find(const char* s) const;
+};
+
+/** Wildcard mask ('*' and '?'), compiled once and matched without case
+ * (RFC1459).
+ *
+ * The literal prefix and suffix are checked first, so most strings are
+ * rejected without scanning them.
+ */
+class MaskMatcher
+{
+	string prefix;
+	string suffix;
+	std::vector<string> middle;
+	bool wildcard;
+
+	static bool matchAt(const string& segment, const char* s);
+
+public:
+	MaskMatcher(const string& pattern);
+
+	bool match(const string& s) const;
+};
+
+/** Bounded cache which evicts its least recently used entry. */
+template<typename K, typename V>
+class LRUCache
+{
+	typedef std::list<std::pair<K, V> > List;
+	List entries;
+	std::tr1::unordered_map<K, typename List::iterator> index;
+	size_t max_size;
+
+public:
+	LRUCache(size_t _max_size) : max_size(_max_size) {}
+
+	/** Find a value and mark it as recently used.
+	 *
+	 * @return  NULL if key is not cached.
+	 */
+	const V* find(const K& key)
+	{
+		typename std::tr1::unordered_map<K, typename List::iterator>::iterator it = index.find(key);
+		if(it == index.end())
+			return NULL;
+
+		entries.splice(entries.begin(), entries, it->second);
+		return &it->second->second;
+	}
+
+	void insert(const K& key, const V& value)
+	{
+		typename std::tr1::unordered_map<K, typename List::iterator>::iterator it = index.find(key);
+		if(it != index.end())
+		{
+			it->second->second = value;
+			entries.splice(entries.begin(), entries, it->second);
+			return;
+		}
+
+		entries.push_front(std::make_pair(key, value));
+		index[key] = entries.begin();
+		if(entries.size() > max_size)
+		{
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+	void clear()
+	{
+		entries.clear();
+		index.clear();
+	}
+};
+
 gchar* markup2irc(const gchar* markup);
 gchar* irc2markup(const gchar* string);
 
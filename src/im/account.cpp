@@ -34,6 +34,7 @@
 #include "irc/status_channel.h"
 #include "irc/user.h"
 #include "irc/buddy.h"
+#include "irc/server.h"
 
 namespace im {
 
@@ -531,8 +532,14 @@ void Account::updatedAllBuddies() const
 {
 	assert(isValid());
 	vector<Buddy> buddies = getBuddies();
+	vector<std::pair<irc::Nick*, int> > joins;
 	for(vector<Buddy>::iterator it = buddies.begin(); it != buddies.end(); ++it)
-		it->updated();
+		it->updated(&joins);
+
+	/* Join every online buddies at once to avoid a JOIN storm. */
+	irc::StatusChannel* chan = getStatusChannel();
+	if(chan && !joins.empty())
+		chan->addUsers(joins);
 }
 
 void Account::displayRoomList() const
@@ -585,6 +592,12 @@ void Account::removeReconnection(bool verbose) const
 	purple_account_set_ui_int(account, MINBIF_VERSION_NAME, "id-reconnect", -1);
 }
 
+bool Account::hasReconnection() const
+{
+	assert(isValid());
+	return purple_account_get_ui_int(account, MINBIF_VERSION_NAME, "id-reconnect", -1) >= 0;
+}
+
 irc::StatusChannel* Account::getStatusChannel() const
 {
 	irc::IRC* irc = Purple::getIM()->getIRC();
@@ -634,9 +647,7 @@ void Account::createStatusChannel()
 
 	chan->addAccount(*this);
 
-	vector<Buddy> buddies = getBuddies();
-	for(vector<Buddy>::iterator b = buddies.begin(); b != buddies.end(); ++b)
-		b->updated();
+	updatedAllBuddies();
 }
 
 void Account::leaveStatusChannel()
@@ -978,6 +989,12 @@ void Account::account_removed(PurpleAccount* a)
 	account.abortChannelJoins();
 	account.removeReconnection();
 	account.leaveStatusChannel();
+
+	/* Do not wait for a reconnection anymore. */
+	irc::IRC* irc = Purple::getIM()->getIRC();
+	irc::RemoteServer* server = dynamic_cast<irc::RemoteServer*>(irc->getServer(account.getServername()));
+	if(server && server->isStale())
+		irc->removeServer(account.getServername());
 }
 
 static char *make_info(PurpleAccount *account, PurpleConnection *gc, const char *remote_user,
@@ -1190,7 +1207,13 @@ void Account::connected(PurpleConnection* gc)
 	irc::IRC* irc = Purple::getIM()->getIRC();
 
 	b_log[W_INFO|W_SNO] << "Connection to " << account.getServername() << " established!";
-	irc->addServer(new irc::RemoteServer(irc, account));
+
+	/* Nicks kept from the previous connection are reconciled once signed on. */
+	irc::RemoteServer* server = dynamic_cast<irc::RemoteServer*>(irc->getServer(account.getServername()));
+	if(server && server->isStale())
+		server->cancelExpiration();
+	else
+		irc->addServer(new irc::RemoteServer(irc, account));
 	account.flushChannelJoins();
 }
 
@@ -1199,6 +1222,14 @@ void Account::account_signed_on_cb(PurpleConnection *gc, gpointer event)
 	Account account = Account(gc->account);
 	GList* list = purple_get_chats();
 
+	/* Only send presence changes which occured during the outage. */
+	irc::RemoteServer* server = dynamic_cast<irc::RemoteServer*>(Purple::getIM()->getIRC()->getServer(account.getServername()));
+	if(server && server->isStale())
+	{
+		server->setFresh();
+		account.updatedAllBuddies();
+	}
+
 	/* Rejoin channels. */
 	for(; list; list = list->next)
 	{
@@ -1254,6 +1285,16 @@ void Account::disconnected(PurpleConnection* gc)
 			purple_conversation_set_data(c.getPurpleConversation(), "want-to-rejoin", GINT_TO_POINTER(TRUE));
 	}
 
+	/* Keep nicks during a network blip, to avoid a QUIT/JOIN storm. */
+	irc::RemoteServer* server = dynamic_cast<irc::RemoteServer*>(Purple::getIM()->getIRC()->getServer(account.getServername()));
+	int grace = conf.GetSection("irc")->GetItem("reconnect_grace")->Integer();
+	if(server && grace > 0 && account.hasReconnection())
+	{
+		b_log[W_INFO|W_SNO] << "Keeping link with " << account.getServername() << " during " << grace << " seconds";
+		server->setStale(grace);
+		return;
+	}
+
 	b_log[W_INFO|W_SNO] << "Closing link with " << account.getServername();
 	Purple::getIM()->getIRC()->removeServer(account.getServername());
 }
@@ -184,6 +184,9 @@ namespace im
 		/** Abort the auto-reconnection. */
 		void removeReconnection(bool verbose = false) const;
 
+		/** Is an auto-reconnection scheduled? */
+		bool hasReconnection() const;
+
 		/** Get list of available commands. */
 		vector<string> getCommandsList() const;
 
@@ -26,6 +26,7 @@
 #include "core/log.h"
 #include "irc/buddy.h"
 #include "irc/irc.h"
+#include "irc/server.h"
 #include "irc/channel.h"
 #include "irc/status_channel.h"
 
@@ -130,7 +131,7 @@ void Buddy::sendFile(string filename)
 		       filename.c_str());
 }
 
-void Buddy::updated() const
+void Buddy::updated(vector<std::pair<irc::Nick*, int> >* joins) const
 {
 	irc::StatusChannel* chan = getAccount().getStatusChannel();
 	if(!chan)
@@ -138,16 +139,27 @@ void Buddy::updated() const
 
 	irc::Buddy* n = getNick();
 	if(!n)
-		n = dynamic_cast<irc::Buddy*>(Purple::getIM()->getIRC()->getNick(*this));
+		n = Purple::getIM()->getIRC()->getNick(*this);
 	if(!n)
 		return;
+
+	/* Presence is reconciled when the account is signed on again. */
+	irc::RemoteServer* server = dynamic_cast<irc::RemoteServer*>(n->getServer());
+	if(server && server->isStale())
+		return;
+
 	if(isOnline())
 	{
 		bool available = isAvailable() && Purple::getIM()->hasVoicedBuddies();
 		irc::ChanUser* chanuser = n->getChanUser(chan);
 
 		if(!chanuser)
-			n->join(chan, available ? irc::ChanUser::VOICE : 0);
+		{
+			if(joins)
+				joins->push_back(std::make_pair(n, available ? irc::ChanUser::VOICE : 0));
+			else
+				n->join(chan, available ? irc::ChanUser::VOICE : 0);
+		}
 		else if(available ^ chanuser->hasStatus(irc::ChanUser::VOICE))
 		{
 			if(available)
@@ -319,8 +331,7 @@ void Buddy::update_node(PurpleBuddyList *list, PurpleBlistNode *node)
 				return;
 
 			n = new irc::Buddy(server, buddy);
-			while(Purple::getIM()->getIRC()->getNick(n->getNickname()))
-				n->setNickname(n->getNickname() + "_");
+			n->setNickname(Purple::getIM()->getIRC()->getFreeNickname(n->getNickname()));
 
 			Purple::getIM()->getIRC()->addNick(n);
 		}
@@ -333,7 +344,13 @@ void Buddy::update_node(PurpleBuddyList *list, PurpleBlistNode *node)
 		if(buddy.getAlias() != n->getNickname())
 			buddy.setAlias(n->getNickname(), false);
 
-		buddy.updated();
+		/* Coalesce presence changes of flapping buddies. */
+		int delay = conf.GetSection("irc")->GetItem("presence_delay")->Integer();
+		irc::RemoteServer* server = dynamic_cast<irc::RemoteServer*>(n->getServer());
+		if(server && delay > 0)
+			server->updatePresence(n, delay);
+		else
+			buddy.updated();
 	}
 }
 
@@ -349,7 +366,7 @@ void Buddy::removed_node(PurpleBuddyList *list, PurpleBlistNode *node)
 		Buddy buddy = Buddy((PurpleBuddy*)node);
 		irc::Buddy* n = buddy.getNick();
 		if(!n)
-			n = dynamic_cast<irc::Buddy*>(Purple::getIM()->getIRC()->getNick(buddy));
+			n = Purple::getIM()->getIRC()->getNick(buddy);
 		if(n)
 		{
 			n->quit("Removed");
@@ -21,17 +21,21 @@
 
 #include <purple.h>
 #include <string>
+#include <vector>
+#include <utility>
 
 #include "core/caca_image.h"
 
 namespace irc
 {
+	class Nick;
 	class Buddy;
 };
 
 namespace im
 {
 	using std::string;
+	using std::vector;
 
 	class Account;
 
@@ -98,8 +102,13 @@ namespace im
 		 */
 		void retrieveInfo() const;
 
-		/** Buddy has been updated, so change his IRC status. */
-		void updated() const;
+		/** Buddy has been updated, so change his IRC status.
+		 *
+		 * @param joins  if not NULL, the IRC nick is appended to this list
+		 *               instead of joining the status channel, so the
+		 *               caller can join every nicks at once.
+		 */
+		void updated(vector<std::pair<irc::Nick*, int> >* joins = NULL) const;
 
 		/** Send a file to this buddy. */
 		void sendFile(string filename);
@@ -430,7 +430,7 @@ void Conversation::recvMessage(string from, string text, bool action)
 			{
 				/* There isn't any Nick associated to this conversation. Try to
 				 * find a Nick with this conversation object. */
-				n = dynamic_cast<irc::ConvNick*>(irc->getNick(*this));
+				n = irc->getNick(*this);
 				if(!n)
 				{
 					/* If there isn't any conversation, try to find a buddy. */
@@ -443,8 +443,7 @@ void Conversation::recvMessage(string from, string text, bool action)
 
 						/* Ok, there isn't any buddy, so I create an unknown buddy to chat with him. */
 						n = new irc::UnknownBuddy(irc->getServer(getAccount().getServername()), *this);
-						while((irc->getNick(n->getNickname())))
-							n->setNickname(n->getNickname() + "_");
+						n->setNickname(irc->getFreeNickname(n->getNickname()));
 						irc->addNick(n);
 					}
 				}
@@ -474,9 +473,7 @@ void Conversation::recvMessage(string from, string text, bool action)
 			 */
 			if(!n)
 			{
-				from = irc::Nick::nickize(from);
-				while((irc->getNick(from)))
-					from += "_";
+				from = irc->getFreeNickname(irc::Nick::nickize(from), NULL, false);
 			}
 
 			string line;
@@ -585,7 +582,7 @@ void Conversation::destroy(PurpleConversation* c)
 			conv.setNick(NULL);
 
 			irc::IRC* irc = Purple::getIM()->getIRC();
-			irc::ConvNick* n = dynamic_cast<irc::ConvNick*>(irc->getNick(conv));
+			irc::ConvNick* n = irc->getNick(conv);
 			if(n)
 				n->setConversation(Conversation());
 			break;
@@ -674,19 +671,19 @@ void Conversation::add_users(PurpleConversation *c, GList *cbuddies,
 			     gboolean new_arrivals)
 {
 	Conversation conv(c);
-	GList* l = cbuddies;
-	for (; l != NULL; l = l->next)
+	irc::ConversationChannel* chan = conv.getChannel();
+	if(!chan)
 	{
-		ChatBuddy cbuddy = ChatBuddy(conv, (PurpleConvChatBuddy *)l->data);
-
-		irc::ConversationChannel* chan = conv.getChannel();
-		if(!chan)
-		{
-			b_log[W_ERR] << "Conversation channel doesn't exist: " << conv.getChanName();
-			return;
-		}
-		chan->addBuddy(cbuddy, cbuddy.getChanStatus());
+		b_log[W_ERR] << "Conversation channel doesn't exist: " << conv.getChanName();
+		return;
 	}
+
+	vector<ChatBuddy> buddies;
+	for(GList* l = cbuddies; l != NULL; l = l->next)
+		buddies.push_back(ChatBuddy(conv, (PurpleConvChatBuddy *)l->data));
+
+	/* Join every buddies at once to avoid a JOIN storm. */
+	chan->addBuddies(buddies);
 }
 
 void Conversation::update_user(PurpleConversation* c, const char* user)
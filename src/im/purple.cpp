@@ -17,7 +17,10 @@
  */
 
 #include <purple.h>
+#include <gmodule.h>
 #include <cassert>
+#include <cstdio>
+#include <sys/time.h>
 
 #include "purple.h"
 #include "im.h"
@@ -34,8 +37,44 @@
 #include "core/util.h"
 #include "core/config.h"
 
+#ifndef PURPLE_PLUGINDIR
+#define PURPLE_PLUGINDIR "/usr/lib/purple-2"
+#endif
+
 namespace im {
 
+/* Milliseconds since a previous call. */
+static unsigned long elapsed_ms(const struct timeval& since)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since.tv_sec) * 1000 + (now.tv_usec - since.tv_usec) / 1000;
+}
+
+/* Resident memory, and the part of it which is not shared with any other
+ * process (copy-on-write pages inherited from a master are shared until
+ * written), in KB. */
+static bool memory_usage(long& rss, long& priv)
+{
+	char line[256];
+	long v;
+	FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+	if(!fp)
+		return false;
+
+	rss = priv = 0;
+	while(fgets(line, sizeof line, fp))
+	{
+		if(sscanf(line, "Rss: %ld", &v) == 1)
+			rss = v;
+		else if(sscanf(line, "Private_Clean: %ld", &v) == 1 ||
+			sscanf(line, "Private_Dirty: %ld", &v) == 1)
+			priv += v;
+	}
+	fclose(fp);
+	return true;
+}
+
 IM* Purple::im = NULL;
 
 PurpleEventLoopUiOps Purple::eventloop_ops =
@@ -139,8 +178,17 @@ void Purple::init(IM* im)
 	purple_eventloop_set_ui_ops(&eventloop_ops);
 
 	Purple::im = im;
+
+	struct timeval start;
+	gettimeofday(&start, NULL);
 	if (!purple_core_init(MINBIF_VERSION_NAME))
 		throw PurpleError("Initialization of the Purple core failed.");
+	long rss, priv;
+	if(memory_usage(rss, priv))
+		b_log[W_INFO] << "Purple core initialized in " << elapsed_ms(start) << "ms, "
+		              << "RSS " << rss << "KB, private " << priv << "KB";
+	else
+		b_log[W_INFO] << "Purple core initialized in " << elapsed_ms(start) << "ms";
 
 	/* XXX the currently implementation of this function works only with
 	 * dbus, but minbif does not use it. */
@@ -186,6 +234,52 @@ void Purple::uninit()
 	Media::uninit();
 }
 
+unsigned Purple::preloadPlugins()
+{
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	long rss_before = 0, rss_after = 0, priv;
+	bool memory = memory_usage(rss_before, priv);
+	unsigned count = 0;
+
+	GDir* dir = g_dir_open(PURPLE_PLUGINDIR, 0, NULL);
+	if(!dir)
+	{
+		b_log[W_WARNING] << "Unable to preload plugins from " << PURPLE_PLUGINDIR;
+		return 0;
+	}
+
+	const gchar* file;
+	while((file = g_dir_read_name(dir)) != NULL)
+	{
+		if(!g_str_has_suffix(file, G_MODULE_SUFFIX))
+			continue;
+
+		/* Same path and flags than libpurple, to get the same handle. */
+		gchar* path = g_build_filename(PURPLE_PLUGINDIR, file, NULL);
+		GModule* module = g_module_open(path, G_MODULE_BIND_LOCAL);
+		if(!module)
+			module = g_module_open(path, (GModuleFlags)(G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL));
+		if(module)
+		{
+			g_module_make_resident(module);
+			count++;
+		}
+		else
+			b_log[W_DEBUG] << "Unable to preload " << path << ": " << g_module_error();
+		g_free(path);
+	}
+	g_dir_close(dir);
+
+	/* Pages loaded here are shared by every child until written. */
+	if(memory && memory_usage(rss_after, priv))
+		b_log[W_INFO] << "Preloaded " << count << " plugins in " << elapsed_ms(start) << "ms, "
+		              << "RSS grew by " << (rss_after - rss_before) << "KB";
+	else
+		b_log[W_INFO] << "Preloaded " << count << " plugins in " << elapsed_ms(start) << "ms";
+	return count;
+}
+
 map<string, Plugin> Purple::getPluginsList()
 {
 	map<string, Plugin> m;
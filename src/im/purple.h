@@ -74,6 +74,16 @@ namespace im
 		/** Uninitialization */
 		static void uninit();
 
+		/** Load every plugin found in the libpurple plugins directory.
+		 *
+		 * It is called by a daemon master before any fork, so children
+		 * share already loaded and relocated modules, and their probing
+		 * only finds them in memory.
+		 *
+		 * @return  number of loaded modules.
+		 */
+		static unsigned preloadPlugins();
+
 		static IM* getIM() { return im; }
 
 		static map<string, Plugin> getPluginsList();
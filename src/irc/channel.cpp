@@ -20,6 +20,7 @@
 #include "message.h"
 #include "irc.h"
 #include "core/util.h"
+#include "core/callback.h"
 
 namespace irc {
 
@@ -29,7 +30,9 @@ ChanUser::ChanUser(Channel* _chan, Nick* _nick, int _status)
 	: Entity(_nick->getNickname()),
 	  nick(_nick),
 	  chan(_chan),
-	  status(_status)
+	  status(_status),
+	  chan_pos(0),
+	  nick_pos(0)
 {
 }
 
@@ -38,7 +41,7 @@ string ChanUser::getName() const
 	return nick->getNickname();
 }
 
-string ChanUser::getLongName() const
+const string& ChanUser::getLongName() const
 {
 	return nick->getLongName();
 }
@@ -106,11 +109,22 @@ Message ChanUser::getModeMessage(bool add, int modes) const
 
 Channel::Channel(IRC* _irc, string name)
 	: Entity(name),
-	  irc(_irc)
+	  irc(_irc),
+	  modes_id(-1),
+	  modes_cb(NULL),
+	  names_id(-1),
+	  names_cb(NULL)
 {}
 
 Channel::~Channel()
 {
+	if(modes_id >= 0)
+		g_source_remove(modes_id);
+	delete modes_cb;
+	if(names_id >= 0)
+		g_source_remove(names_id);
+	delete names_cb;
+
 	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); ++it)
 	{
 		(*it)->getNick()->send(Message(MSG_PART).setSender(*it)
@@ -121,73 +135,248 @@ Channel::~Channel()
 	users.clear();
 }
 
-void Channel::sendNames(Nick* nick) const
+void Channel::sendNames(Nick* nick)
 {
-	string names;
+	names_query_t query;
+	query.nick = nick;
+	query.pos = 0;
+	names_queries.push_back(query);
+
+	/* Members are listed in the order they had when NAMES was requested. */
+	vector<string>& members = names_queries.back().members;
+	members.reserve(users.size());
 	for(vector<ChanUser*>::const_iterator it = users.begin(); it != users.end(); ++it)
+		members.push_back((*it)->getNick()->getNickname());
+
+	if(names_id < 0)
+		processNames();
+}
+
+bool Channel::processNames(void*)
+{
+	unsigned count = 0;
+
+	while(!names_queries.empty() && count < NAMES_PER_LOOP)
+	{
+		names_query_t& query = names_queries.front();
+		Nick* nick = query.nick;
+
+		/* Split the list to keep every line under the 512 bytes limit. */
+		size_t max_len = 512 - (irc->getLongName().size() + nick->getNickname().size() + getName().size() + 16);
+		string names;
+		for(; query.pos < query.members.size() && count < NAMES_PER_LOOP; ++query.pos, ++count)
+		{
+			/* Members may have left between two chunks. */
+			Nick* n = irc->getNick(query.members[query.pos], true);
+			ChanUser* chanuser = n ? n->getChanUser(this) : NULL;
+			if(!chanuser)
+				continue;
+
+			string name = chanuser->getPrefix() + n->getNickname();
+			if(!names.empty() && names.size() + name.size() + 1 > max_len)
+			{
+				nick->send(Message(RPL_NAMREPLY).setSender(irc)
+						           .setReceiver(nick)
+							   .addArg("=")
+							   .addArg(getName())
+							   .addArg(names));
+				names.clear();
+			}
+			names += name;
+			// We're detecting that a space exists before prepending : to arguments.
+			// If we don't do it this way, a single-user channel won't prepend the colon to the
+			// user list.
+			// See Message::format()
+			names += " ";
+		}
+
+		if(!names.empty())
+			nick->send(Message(RPL_NAMREPLY).setSender(irc)
+					           .setReceiver(nick)
+						   .addArg("=")
+						   .addArg(getName())
+						   .addArg(names));
+
+		if(query.pos < query.members.size())
+			break;
+
+		nick->send(Message(RPL_ENDOFNAMES).setSender(irc)
+				           .setReceiver(nick)
+					   .addArg(getName())
+					   .addArg("End of /NAMES list"));
+		names_queries.pop_front();
+	}
+
+	if(!names_queries.empty())
 	{
-		names += (*it)->getPrefix();
-		names += (*it)->getNick()->getNickname();
-		// We're detecting that a space exists before prepending : to arguments.
-		// If we don't do it this way, a single-user channel won't prepend the colon to the
-		// user list.
-		// See Message::format()
-		names += " ";
+		if(names_id < 0)
+		{
+			if(!names_cb)
+				names_cb = new CallBack<Channel>(this, &Channel::processNames);
+			names_id = g_timeout_add(0, g_callback, names_cb);
+		}
+		return true;
 	}
 
-	nick->send(Message(RPL_NAMREPLY).setSender(irc)
-			           .setReceiver(nick)
-				   .addArg("=")
-				   .addArg(getName())
-				   .addArg(names));
-	nick->send(Message(RPL_ENDOFNAMES).setSender(irc)
-			           .setReceiver(nick)
-				   .addArg(getName())
-				   .addArg("End of /NAMES list"));
+	names_id = -1;
+	return false;
+}
+
+void Channel::dropNames(const Nick* nick)
+{
+	for(std::deque<names_query_t>::iterator it = names_queries.begin(); it != names_queries.end(); )
+		if(it->nick == nick)
+			it = names_queries.erase(it);
+		else
+			++it;
 }
 
 ChanUser* Channel::addUser(Nick* nick, int status)
 {
-	ChanUser* chanuser = new ChanUser(this, nick, status);
-	users.push_back(chanuser);
+	vector<std::pair<Nick*, int> > members;
+	members.push_back(std::make_pair(nick, status));
+	return addUsers(members).front();
+}
 
-	string names;
-	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); ++it)
+vector<ChanUser*> Channel::addUsers(const vector<std::pair<Nick*, int> >& members)
+{
+	vector<ChanUser*> chanusers;
+	vector<ChanUser*> added;
+
+	/* Only members attached to a socket care about JOINs. */
+	vector<Nick*> listeners = getListeners();
+
+	chanusers.reserve(members.size());
+	users.reserve(users.size() + members.size());
+	for(vector<std::pair<Nick*, int> >::const_iterator it = members.begin(); it != members.end(); ++it)
 	{
-		(*it)->getNick()->send(Message(MSG_JOIN).setSender(nick).setReceiver(this));
-		if(status && (*it)->getNick() != nick)
+		Nick* nick = it->first;
+		ChanUser* chanuser = nick->getChanUser(this);
+		if(!chanuser)
 		{
-			Message m = chanuser->getModeMessage(true);
-			m.setSender(irc);
-			m.setReceiver(this);
-			(*it)->getNick()->send(m);
+			chanuser = new ChanUser(this, nick, it->second);
+			attachUser(chanuser);
+			nick->addChanUser(chanuser);
+			added.push_back(chanuser);
+		}
+		chanusers.push_back(chanuser);
+	}
+
+	for(vector<ChanUser*>::iterator it = added.begin(); it != added.end(); ++it)
+	{
+		Nick* nick = (*it)->getNick();
+		Message join = Message(MSG_JOIN).setSender(nick).setReceiver(this);
+
+		if(nick->hasSocket())
+		{
+			nick->send(join);
+
+			string topic = getTopic();
+			if(!topic.empty())
+				nick->send(Message(RPL_TOPIC).setSender(irc)
+							     .setReceiver(nick)
+							     .addArg(getName())
+							     .addArg(topic));
+
+			sendNames(nick);
+		}
+
+		if(listeners.empty())
+			continue;
+
+		join.formatShared();
+		Message mode;
+		if((*it)->getStatus())
+		{
+			mode = (*it)->getModeMessage(true);
+			mode.setSender(irc);
+			mode.setReceiver(this);
+			mode.formatShared();
+		}
+
+		for(vector<Nick*>::iterator l = listeners.begin(); l != listeners.end(); ++l)
+		{
+			(*l)->send(join);
+			if((*it)->getStatus())
+				(*l)->send(mode);
 		}
 	}
-	string topic = getTopic();
-	if(!topic.empty())
-		nick->send(Message(RPL_TOPIC).setSender(irc)
-					     .setReceiver(nick)
-					     .addArg(getName())
-					     .addArg(topic));
-
-	sendNames(nick);
-	return chanuser;
+
+	return chanusers;
+}
+
+void Channel::attachUser(ChanUser* chanuser)
+{
+	chanuser->chan_pos = users.size();
+	users.push_back(chanuser);
+}
+
+void Channel::detachUser(ChanUser* chanuser)
+{
+	ChanUser* last = users.back();
+	users[chanuser->chan_pos] = last;
+	last->chan_pos = chanuser->chan_pos;
+	users.pop_back();
 }
 
 void Channel::delUser(Nick* nick, Message m)
 {
-	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); )
-		if((*it)->getNick() == nick)
+	ChanUser* chanuser = nick->getChanUser(this);
+	if(!chanuser)
+		return;
+
+	dropModes(nick);
+	dropNames(nick);
+	nick->removeChanUser(chanuser);
+	detachUser(chanuser);
+	delete chanuser;
+
+	if(m.getCommand().empty())
+		return;
+
+	flushModes();
+	m.formatShared();
+	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); ++it)
+		if(isRecipient((*it)->getNick(), m))
+			(*it)->getNick()->send(m);
+}
+
+void Channel::delUsers(const std::tr1::unordered_set<Nick*>& nicks)
+{
+	for(vector<mode_change_t>::iterator it = pending_modes.begin(); it != pending_modes.end(); )
+		if(nicks.find(it->nick) != nicks.end())
+			it = pending_modes.erase(it);
+		else
+			++it;
+
+	for(std::deque<names_query_t>::iterator it = names_queries.begin(); it != names_queries.end(); )
+		if(nicks.find(it->nick) != nicks.end())
+			it = names_queries.erase(it);
+		else
+			++it;
+
+	vector<ChanUser*>::iterator out = users.begin();
+	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); ++it)
+		if(nicks.find((*it)->getNick()) != nicks.end())
 		{
+			(*it)->getNick()->removeChanUser(*it);
 			delete *it;
-			it = users.erase(it);
 		}
 		else
 		{
-			if(m.getCommand().empty() == false)
-				(*it)->getNick()->send(m);
-			++it;
+			(*it)->chan_pos = out - users.begin();
+			*out++ = *it;
 		}
+	users.erase(out, users.end());
+}
+
+vector<Nick*> Channel::getListeners() const
+{
+	vector<Nick*> listeners;
+	for(vector<ChanUser*>::const_iterator it = users.begin(); it != users.end(); ++it)
+		if((*it)->getNick()->hasSocket())
+			listeners.push_back((*it)->getNick());
+	return listeners;
 }
 
 ChanUser* Channel::getChanUser(string nick) const
@@ -200,11 +389,26 @@ ChanUser* Channel::getChanUser(string nick) const
 	return NULL;
 }
 
+bool Channel::isRecipient(const Nick* nick, const Message& m)
+{
+	/* Nicks without socket only handle PRIVMSGs (see Buddy::send()) */
+	return nick->hasSocket() || m.getCommand() == MSG_PRIVMSG;
+}
+
 void Channel::broadcast(Message m, Nick* butone)
 {
+	/* Keep pending modes ordered with other messages. */
+	flushModes();
+
+	/* Copies share the formatted line. */
+	m.formatShared();
+
 	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); ++it)
-		if(!butone || (*it)->getNick() != butone)
-			(*it)->getNick()->send(m);
+	{
+		Nick* nick = (*it)->getNick();
+		if((!butone || nick != butone) && isRecipient(nick, m))
+			nick->send(m);
+	}
 }
 
 void Channel::m_mode(Nick* user, Message m)
@@ -253,21 +457,78 @@ void Channel::setMode(const Entity* sender, int modes, ChanUser* chanuser)
 {
 	if(!modes) return;
 	chanuser->setStatus(modes);
-	Message m = chanuser->getModeMessage(true, modes);
-	m.setSender(sender ? sender : irc);
-	m.setReceiver(this);
-	broadcast(m);
+	queueModes(sender, true, modes, chanuser);
 }
 
 void Channel::delMode(const Entity* sender, int modes, ChanUser* chanuser)
 {
 	if(!modes) return;
 	chanuser->delStatus(modes);
-	Message m = chanuser->getModeMessage(false, modes);
-	m.setSender(sender ? sender : irc);
-	m.setReceiver(this);
-	broadcast(m);
+	queueModes(sender, false, modes, chanuser);
+}
+
+void Channel::queueModes(const Entity* sender, bool add, int modes, ChanUser* chanuser)
+{
+	for(size_t i = 0; i < sizeof ChanUser::m2c / sizeof *ChanUser::m2c; ++i)
+		if(ChanUser::m2c[i].mode & modes)
+		{
+			mode_change_t change = { sender ? sender : irc, add, ChanUser::m2c[i].c, chanuser->getNick() };
+			pending_modes.push_back(change);
+		}
+
+	if(modes_id >= 0)
+		return;
+
+	if(!modes_cb)
+		modes_cb = new CallBack<Channel>(this, &Channel::flushModes);
+	modes_id = g_timeout_add(0, g_callback, modes_cb);
+}
+
+void Channel::dropModes(const Nick* nick)
+{
+	for(vector<mode_change_t>::iterator it = pending_modes.begin(); it != pending_modes.end(); )
+		if(it->nick == nick)
+			it = pending_modes.erase(it);
+		else
+			++it;
+}
 
+bool Channel::flushModes(void*)
+{
+	if(modes_id >= 0)
+	{
+		g_source_remove(modes_id);
+		modes_id = -1;
+	}
+	if(pending_modes.empty())
+		return false;
+
+	/* broadcast() flushes modes too, so empty the queue first. */
+	vector<mode_change_t> changes;
+	changes.swap(pending_modes);
+
+	vector<mode_change_t>::iterator it = changes.begin();
+	while(it != changes.end())
+	{
+		const Entity* sender = it->sender;
+		Message m = Message(MSG_MODE).setSender(sender)
+		                             .setReceiver(this)
+		                             .addArg("");
+		string modes_str;
+		bool add = it->add;
+
+		for(unsigned n = 0; n < MAX_MODES && it != changes.end() && it->sender == sender; ++n, ++it)
+		{
+			if(n == 0 || add != it->add)
+				modes_str += it->add ? '+' : '-';
+			add = it->add;
+			modes_str += it->c;
+			m.addArg(it->nick->getNickname());
+		}
+		m.setArg(0, modes_str);
+		broadcast(m);
+	}
+	return false;
 }
 
 bool Channel::setTopic(Entity* chanuser, const string& topic)
@@ -21,11 +21,16 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <utility>
+#include <tr1/unordered_set>
 
 #include "message.h"
 #include "core/entity.h"
 #include "core/util.h"
 
+class _CallBack;
+
 namespace irc
 {
 	using std::vector;
@@ -43,6 +48,12 @@ namespace irc
 		Channel* chan;
 		int status;
 
+		/* Positions in Channel::users and Nick::channels, for an O(1) removal. */
+		size_t chan_pos;
+		size_t nick_pos;
+		friend class Channel;
+		friend class Nick;
+
 	public:
 
 		/** Channel user modes */
@@ -71,7 +82,7 @@ namespace irc
 		ChanUser(Channel* chan, Nick* nick, int status = 0);
 
 		string getName() const;
-		string getLongName() const;
+		const string& getLongName() const;
 
 		bool hasStatus(int flag) const { return status & flag; }
 		void setStatus(int flag) { status |= flag; }
@@ -106,14 +117,60 @@ namespace irc
 	protected:
 		IRC* irc;
 
+		/** Check if a nick has to receive a message broadcasted on channel. */
+		static bool isRecipient(const Nick* nick, const Message& m);
+
 	private:
 		vector<ChanUser*> users;
 		string topic;
 
+		void attachUser(ChanUser* chanuser);
+		void detachUser(ChanUser* chanuser);
+
+		/** A mode change waiting to be sent in a batched MODE line. */
+		struct mode_change_t
+		{
+			const Entity* sender;
+			bool add;
+			char c;
+			Nick* nick;
+		};
+		vector<mode_change_t> pending_modes;
+		int modes_id;
+		_CallBack* modes_cb;
+
+		void queueModes(const Entity* sender, bool add, int modes, ChanUser* chanuser);
+		void dropModes(const Nick* nick);
+
+		/** A NAMES reply being sent. */
+		struct names_query_t
+		{
+			Nick* nick;               /**< receiver */
+			vector<string> members;   /**< nicknames when NAMES was requested */
+			size_t pos;               /**< member to resume from */
+		};
+		std::deque<names_query_t> names_queries;
+		int names_id;
+		_CallBack* names_cb;
+
+		/** Maximum number of members listed by NAMES in one main loop iteration. */
+		static const unsigned NAMES_PER_LOOP = 512;
+
+		/** Send the next lines of pending NAMES replies. */
+		bool processNames(void* = NULL);
+		void dropNames(const Nick* nick);
+
 	public:
+		/** Send pending mode changes now, to keep them ordered with
+		 * messages sent to channel members.
+		 */
+		bool flushModes(void* = NULL);
 
 		static const char *CHMODES;
 
+		/** Maximum number of mode changes in a MODE line. */
+		static const unsigned MAX_MODES = 4;
+
 		/** Build the Channel object.
 		 *
 		 * @param irc  the IRC object of main server
@@ -147,6 +204,18 @@ namespace irc
 		 */
 		ChanUser* addUser(Nick* nick, int status=0);
 
+		/** Add several nicks on channel.
+		 *
+		 * Every members are registered first. Then members attached to
+		 * a socket receive one JOIN per new member, and new members
+		 * attached to a socket receive the topic and the NAMES list.
+		 * Nicks already on channel are kept as is.
+		 *
+		 * @param members  nicks to add, with their initial status
+		 * @return  the ChanUser instances, in the same order
+		 */
+		vector<ChanUser*> addUsers(const vector<std::pair<Nick*, int> >& members);
+
 		/** Remove an user from channel.
 		 *
 		 * @param nick  user to remove
@@ -154,11 +223,22 @@ namespace irc
 		 */
 		virtual void delUser(Nick* nick, Message message = Message());
 
+		/** Remove several users from channel in one pass.
+		 *
+		 * Nothing is sent, and nicks are not destroyed.
+		 *
+		 * @param nicks  nicks to remove
+		 */
+		virtual void delUsers(const std::tr1::unordered_set<Nick*>& nicks);
+
 		/** Count users on channel. */
 		size_t countUsers() const { return users.size(); }
 
 		/** Get a vector of channel users. */
-		vector<ChanUser*> getChanUsers() const { return users; }
+		const vector<ChanUser*>& getChanUsers() const { return users; }
+
+		/** Get members attached to a socket. */
+		vector<Nick*> getListeners() const;
 
 		/** Get a channel user. */
 		virtual ChanUser* getChanUser(string nick) const;
@@ -177,10 +257,12 @@ namespace irc
 		void m_mode(Nick* sender, Message m);
 
 		/** Send NAMES reply to an user.
+		 *
+		 * Huge channels are listed in chunks from the main loop.
 		 *
 		 * @param nick  the receiver of messages.
 		 */
-		void sendNames(Nick* nick) const;
+		void sendNames(Nick* nick);
 
 		/** Send a command to this channel. */
 		virtual int sendCommand(const string& cmd) { return PURPLE_CMD_STATUS_WRONG_TYPE; }
@@ -203,6 +285,9 @@ namespace irc
 		virtual void processBan(Nick* from, string pattern, bool add) = 0;
 
 		/** Set a mode on a channel user.
+		 *
+		 * Changes made during an event loop iteration are sent together,
+		 * in MODE lines carrying up to MAX_MODES targets.
 		 *
 		 * @param sender  entity which sets mode.
 		 * @param modes  flags set on channel.
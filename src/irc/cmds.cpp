@@ -29,16 +29,18 @@
 namespace irc {
 
 /** PING [args ...] */
-void IRC::m_ping(Message message)
+void IRC::m_ping(const MessageParser& parser)
 {
-	message.setCommand(MSG_PONG);
-	message.setSender(this);
-	message.setReceiver(this);
-	user->send(message);
+	Message pong(MSG_PONG);
+	pong.setSender(this);
+	pong.setReceiver(this);
+	for(size_t i = 0; i < parser.countArgs(); ++i)
+		pong.addArg(parser.getArg(i).str());
+	user->send(pong);
 }
 
 /** PONG cookie */
-void IRC::m_pong(Message message)
+void IRC::m_pong(const MessageParser& parser)
 {
 	user->delFlag(Nick::PING);
 }
@@ -204,14 +206,14 @@ void IRC::m_admin(Message message)
 }
 
 /** MODE target [modes ..] */
-void IRC::m_mode(Message message)
+void IRC::m_mode(const MessageParser& parser)
 {
-	Message relayed(message.getCommand());
-	string target = message.getArg(0);
+	Message relayed(MSG_MODE);
+	string target = parser.getArg(0).str();
 
 	relayed.setSender(user);
-	for(size_t i = 1; i < message.countArgs(); ++i)
-		relayed.addArg(message.getArg(i));
+	for(size_t i = 1; i < parser.countArgs(); ++i)
+		relayed.addArg(parser.getArg(i).str());
 
 	if(Channel::isChanName(target))
 	{
@@ -380,7 +382,9 @@ void IRC::m_stats(Message message)
 						                     .setReceiver(user)
 								     .addArg(commands[i].cmd)
 								     .addArg(t2s(commands[i].count))
-								     .addArg("0"));
+								     .addArg("0")
+								     .addArg(t2s(commands[i].total_time))
+								     .addArg(t2s(commands[i].max_time)));
 			break;
 		case 'o':
 		{
@@ -474,6 +478,15 @@ void IRC::m_stats(Message message)
 			}
 			break;
 		}
+		case 't':
+		{
+			unsigned long full, resumed;
+			if(sock::SockWrapper::GetHandshakeStats(full, resumed))
+				notice(user, "TLS handshakes: " + t2s(full) + " full, " + t2s(resumed) + " resumed");
+			else
+				notice(user, "TLS is not enabled");
+			break;
+		}
 		case 'u':
 		{
 			unsigned now = time(NULL) - uptime;
@@ -488,10 +501,11 @@ void IRC::m_stats(Message message)
 			arg = "*";
 			notice(user, "a (aways) - List all away messages availables");
 			notice(user, "c (chat params) - List all chat parameters for a specific account");
-			notice(user, "m (commands) - List all IRC commands");
+			notice(user, "m (commands) - List all IRC commands, with usage count and total/max handler time (usec)");
 			notice(user, "o (opers) - List all opers accounts");
 			notice(user, "p (protocols) - List all protocols");
 			notice(user, "P (plugins) - List, load and configure plugins");
+			notice(user, "t (tls) - Display TLS handshakes counters");
 			notice(user, "u (uptime) - Display the server uptime");
 			break;
 	}
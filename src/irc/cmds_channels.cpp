@@ -17,7 +17,6 @@
  */
 
 #include <cstring>
-#include <fnmatch.h>
 
 #include "core/caca_image.h"
 #include "irc/irc.h"
@@ -31,7 +30,6 @@ namespace irc {
 void IRC::m_who(Message message)
 {
 	string arg;
-	Channel* chan = NULL;
 	enum
 	{
 		WHO_STATUS = 1 << 0
@@ -67,42 +65,123 @@ void IRC::m_who(Message message)
 	}
 #undef fset
 
-	if(arg.empty() || !Channel::isChanName(arg) || (chan = getChannel(arg)))
-		for(std::map<string, Nick*>::iterator it = users.begin(); it != users.end(); ++it)
+	who_query_t query;
+	query.mask = arg;
+	query.status = flags & WHO_STATUS;
+	query.count = 0;
+	query.pos = 0;
+	who_queries.push_back(query);
+
+	/* Members are listed in the order they had when WHO was received. */
+	Channel* chan;
+	if(Channel::isChanName(arg) && (chan = getChannel(arg)))
+	{
+		vector<string>& members = who_queries.back().members;
+		const vector<ChanUser*>& chanusers = chan->getChanUsers();
+		members.reserve(chanusers.size());
+		for(vector<ChanUser*>::const_iterator it = chanusers.begin(); it != chanusers.end(); ++it)
+			members.push_back((*it)->getNick()->getNickname());
+	}
+
+	/* Answer in chunks, to let libpurple run during huge replies. */
+	if(who_id < 0)
+		processWho();
+}
+
+void IRC::sendWhoReply(Nick* n, const string& channame, bool status)
+{
+	user->send(Message(RPL_WHOREPLY).setSender(this)
+					.setReceiver(user)
+					.addArg(channame)
+					.addArg(n->getIdentname())
+					.addArg(n->getHostname())
+					.addArg(n->getServer()->getServerName())
+					.addArg(n->getNickname())
+					.addArg(n->isAway() ? "G" : "H")
+					.addArg("0 " + (status ? n->getStatusMessage(true)
+					                       : n->getRealName())));
+}
+
+bool IRC::processWho(void*)
+{
+	unsigned max_results = conf.GetSection("irc")->GetItem("who_max_results")->Integer();
+	unsigned sent = 0, matched = 0;
+
+	while(!who_queries.empty() && sent < WHO_REPLIES_PER_LOOP && matched < WHO_NICKS_PER_LOOP)
+	{
+		who_query_t& query = who_queries.front();
+		const string& arg = query.mask;
+		bool truncated = false;
+
+		if(Channel::isChanName(arg))
 		{
-			Nick* n = it->second;
-			string channame = "*";
-			if(arg.empty() || arg == "*" || arg == "0" || n->getServer()->getServerName().find(arg) != string::npos ||
-			   !fnmatch(arg.c_str(), n->getNickname().c_str(), FNM_NOESCAPE|FNM_CASEFOLD))
+			/* Listing a channel is never truncated. The channel may
+			 * have been left between two chunks. */
+			Channel* chan = getChannel(arg);
+			for(; chan && query.pos < query.members.size() && sent < WHO_REPLIES_PER_LOOP && matched < WHO_NICKS_PER_LOOP; ++query.pos)
 			{
-				vector<ChanUser*> chans = n->getChannels();
-				if(!chans.empty())
-					channame = chans.front()->getChannel()->getName();
+				Nick* n = getNick(query.members[query.pos], true);
+				matched++;
+				if(!n || !n->isOn(chan))
+					continue;
+
+				sendWhoReply(n, arg, query.status);
+				query.count++;
+				sent++;
 			}
-			else if(chan)
+
+			if(chan && query.pos < query.members.size())
+				break;
+		}
+		else
+		{
+			bool all = arg.empty() || arg == "*" || arg == "0";
+			MaskMatcher mask(arg);
+			std::map<string, Nick*>::iterator it = query.next.empty() ? users.begin() : users.lower_bound(query.next);
+			for(; it != users.end() && sent < WHO_REPLIES_PER_LOOP && matched < WHO_NICKS_PER_LOOP; ++it)
 			{
-				if(!n->isOn(chan))
+				Nick* n = it->second;
+				matched++;
+				if(!all && n->getServer()->getName().find(arg) == string::npos &&
+				   !mask.match(n->getNickname()))
 					continue;
-				channame = arg;
+
+				if(max_results && query.count >= max_results)
+				{
+					truncated = true;
+					break;
+				}
+
+				const vector<ChanUser*>& chans = n->getChannels();
+				sendWhoReply(n, chans.empty() ? "*" : chans.front()->getChannel()->getName(), query.status);
+				query.count++;
+				sent++;
 			}
-			else
-				continue;
 
-			user->send(Message(RPL_WHOREPLY).setSender(this)
-							.setReceiver(user)
-							.addArg(channame)
-							.addArg(n->getIdentname())
-							.addArg(n->getHostname())
-							.addArg(n->getServer()->getServerName())
-							.addArg(n->getNickname())
-							.addArg(n->isAway() ? "G" : "H")
-							.addArg("0 " + (flags & WHO_STATUS ? n->getStatusMessage(true)
-							                                   : n->getRealName())));
+			if(!truncated && it != users.end())
+			{
+				query.next = it->first;
+				break;
+			}
 		}
-	user->send(Message(RPL_ENDOFWHO).setSender(this)
-					.setReceiver(user)
-					.addArg(!arg.empty() ? arg : "**")
-					.addArg("End of /WHO list"));
+
+		user->send(Message(RPL_ENDOFWHO).setSender(this)
+						.setReceiver(user)
+						.addArg(!arg.empty() ? arg : "**")
+						.addArg(truncated ? "End of /WHO list (truncated to " + t2s(max_results) + " replies)"
+						                  : "End of /WHO list"));
+		who_queries.pop_front();
+	}
+
+	if(!who_queries.empty())
+	{
+		if(who_id < 0)
+			who_id = g_timeout_add(0, g_callback, who_cb);
+		return true;
+	}
+
+	who_id = -1;
+	return false;
 }
 
 /** WHOIS nick */
@@ -128,9 +207,9 @@ void IRC::m_whois(Message message)
 					 .addArg(n->getHostname())
 					 .addArg("*")
 					 .addArg(n->getRealName()));
-	vector<ChanUser*> chanusers = n->getChannels();
+	const vector<ChanUser*>& chanusers = n->getChannels();
 	string chans;
-	FOREACH(vector<ChanUser*>, chanusers, chanuser)
+	for(vector<ChanUser*>::const_iterator chanuser = chanusers.begin(); chanuser != chanusers.end(); ++chanuser)
 	{
 		if(chans.empty() == false) chans += " ";
 		chans += (*chanuser)->getChannel()->getName();
@@ -237,15 +316,25 @@ void IRC::m_whowas(Message message)
 }
 
 /** PRIVMSG target message */
-void IRC::m_privmsg(Message message)
+void IRC::m_privmsg(const MessageParser& parser)
 {
-	Message relayed(message.getCommand());
-	string targets = message.getArg(0), target;
+	Message relayed(MSG_PRIVMSG);
+	string targets = parser.getArg(0).str(), target;
+	unsigned count = 0;
+
+	relayed.setSender(user);
+	relayed.addArg(parser.getArg(1).str());
 
 	while ((target = stringtok(targets, ",")).empty() == false)
 	{
-		relayed.setSender(user);
-		relayed.addArg(message.getArg(1));
+		if(++count > MAX_TARGETS)
+		{
+			user->send(Message(ERR_TOOMANYTARGETS).setSender(this)
+							      .setReceiver(user)
+							      .addArg(target)
+							      .addArg("Too many recipients"));
+			return;
+		}
 
 		if(Channel::isChanName(target))
 		{
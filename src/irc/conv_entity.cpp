@@ -18,6 +18,7 @@
 #include "core/callback.h"
 #include "irc/nick.h"
 #include "irc/conv_entity.h"
+#include "irc/irc.h"
 
 namespace irc {
 
@@ -74,6 +75,15 @@ ConvNick::ConvNick(Server* server, im::Conversation conv, string nickname,
 	  ConvEntity(conv)
 {}
 
+void ConvNick::setConversation(const im::Conversation& c)
+{
+	IRC* irc = getServer()->getIRC();
+
+	irc->unindexConvNick(this);
+	ConvEntity::setConversation(c);
+	irc->indexConvNick(this);
+}
+
 void ConvNick::sendMessage(Nick* to, const string& t, bool action)
 {
 	string line = t;
@@ -51,6 +51,10 @@ namespace irc
 
 		ConvNick(Server* server, im::Conversation conv, string nickname,
 		         string identname, string hostname, string realname = "");
+
+		/** Set the conversation associated, and keep the IRC index in sync. */
+		virtual void setConversation(const im::Conversation& c);
+
 		/** The ConvNick sends a message to someone. */
 		virtual void sendMessage(Nick* to, const string& text, bool action = false);
 	};
@@ -88,7 +88,34 @@ void ConversationChannel::addBuddy(im::ChatBuddy cbuddy, int status)
 			cul = it->second;
 	}
 
-	cbuddies[cbuddy] = cul;
+	indexBuddy(cbuddy, cul);
+}
+
+void ConversationChannel::addBuddies(const vector<im::ChatBuddy>& buddies)
+{
+	vector<std::pair<Nick*, int> > members;
+	vector<im::ChatBuddy> added;
+
+	for(vector<im::ChatBuddy>::const_iterator it = buddies.begin(); it != buddies.end(); ++it)
+	{
+		if(it->isMe())
+			addBuddy(*it, it->getChanStatus());
+		else if(cbuddies.find(*it) == cbuddies.end())
+		{
+			ChatBuddy* n = new ChatBuddy(upserver, *it);
+
+			irc->addNick(n);
+			members.push_back(std::make_pair(n, it->getChanStatus()));
+			added.push_back(*it);
+		}
+	}
+
+	if(members.empty())
+		return;
+
+	vector<ChanUser*> culs = addUsers(members);
+	for(size_t i = 0; i < added.size(); ++i)
+		indexBuddy(added[i], culs[i]);
 }
 
 void ConversationChannel::updateBuddy(im::ChatBuddy cbuddy)
@@ -114,9 +141,7 @@ void ConversationChannel::renameBuddy(ChanUser* chanuser, im::ChatBuddy cbuddy)
 {
 	ChatBuddy* nick = dynamic_cast<irc::ChatBuddy*>(chanuser->getNick());
 
-	string new_nick = nick->nickize(cbuddy.getName());
-	while(irc->getNick(new_nick))
-		new_nick += "_";
+	string new_nick = irc->getFreeNickname(nick->nickize(cbuddy.getName()), nick);
 
 	if (nick->getNickname() != new_nick) {
 		irc->getUser()->send(irc::Message(MSG_NICK).setSender(nick)
@@ -124,19 +149,51 @@ void ConversationChannel::renameBuddy(ChanUser* chanuser, im::ChatBuddy cbuddy)
 		irc->renameNick(nick, new_nick);
 	}
 
-	cbuddies.erase(nick->getChatBuddy());
+	map<im::ChatBuddy, ChanUser*>::iterator it = cbuddies.find(nick->getChatBuddy());
+	if(it != cbuddies.end())
+		unindexBuddy(it);
 	nick->setChatBuddy(cbuddy);
+	indexBuddy(cbuddy, chanuser);
+}
+
+void ConversationChannel::indexBuddy(const im::ChatBuddy& cbuddy, ChanUser* chanuser)
+{
+	map<im::ChatBuddy, ChanUser*>::iterator it = cbuddies.find(cbuddy);
+	if(it != cbuddies.end())
+		unindexBuddy(it);
+
+	string name = strlower(cbuddy.getName());
 	cbuddies[cbuddy] = chanuser;
+	cbuddies_by_name[name] = chanuser;
+	cbuddies_by_nick.erase(chanuser->getNick());
+	cbuddies_by_nick.insert(std::make_pair(chanuser->getNick(), BuddyKey(cbuddy, name)));
 }
 
-void ConversationChannel::delUser(Nick* nick, Message message)
+void ConversationChannel::unindexBuddy(map<im::ChatBuddy, ChanUser*>::iterator it)
 {
-	map<im::ChatBuddy, ChanUser*>::iterator it;
-	for(it = cbuddies.begin(); it != cbuddies.end() && it->second->getNick() != nick; ++it)
-		;
+	std::tr1::unordered_map<const Nick*, BuddyKey>::iterator key = cbuddies_by_nick.find(it->second->getNick());
+	if(key != cbuddies_by_nick.end() && key->second.first == it->first)
+	{
+		std::tr1::unordered_map<string, ChanUser*>::iterator name = cbuddies_by_name.find(key->second.second);
+		if(name != cbuddies_by_name.end() && name->second == it->second)
+			cbuddies_by_name.erase(name);
+		cbuddies_by_nick.erase(key);
+	}
 
-	if(it != cbuddies.end())
-		cbuddies.erase(it);
+	cbuddies.erase(it);
+}
+
+void ConversationChannel::delUser(Nick* nick, Message message)
+{
+	std::tr1::unordered_map<const Nick*, BuddyKey>::iterator key = cbuddies_by_nick.find(nick);
+	if(key != cbuddies_by_nick.end())
+	{
+		map<im::ChatBuddy, ChanUser*>::iterator it = cbuddies.find(key->second.first);
+		if(it != cbuddies.end())
+			unindexBuddy(it);
+		else
+			cbuddies_by_nick.erase(key);
+	}
 
 	Channel::delUser(nick, message);
 
@@ -149,12 +206,11 @@ void ConversationChannel::delUser(Nick* nick, Message message)
 
 ChanUser* ConversationChannel::getChanUser(string nick) const
 {
-	map<im::ChatBuddy, ChanUser*>::const_iterator it;
-	nick = strlower(nick);
-	for(it = cbuddies.begin(); it != cbuddies.end(); ++it)
-		if(strlower(it->first.getName()) == nick)
-			return it->second;
-	return NULL;
+	std::tr1::unordered_map<string, ChanUser*>::const_iterator it = cbuddies_by_name.find(strlower(nick));
+	if(it != cbuddies_by_name.end())
+		return it->second;
+	else
+		return NULL;
 }
 
 ChanUser* ConversationChannel::getChanUser(const im::ChatBuddy& cb) const
@@ -176,6 +232,17 @@ void ConversationChannel::broadcast(Message m, Nick* butone)
 		Channel::broadcast(m, butone);
 }
 
+void ConversationChannel::delUsers(const std::tr1::unordered_set<Nick*>& nicks)
+{
+	for(map<im::ChatBuddy, ChanUser*>::iterator it = cbuddies.begin(); it != cbuddies.end(); )
+		if(nicks.find(it->second->getNick()) != nicks.end())
+			unindexBuddy(it++);
+		else
+			++it;
+
+	Channel::delUsers(nicks);
+}
+
 string ConversationChannel::getTopic() const
 {
 	return getConversation().getChanTopic();
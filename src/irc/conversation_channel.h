@@ -20,6 +20,7 @@
 #define IRC_CONVERSATION_CHANNEL_H
 
 #include <map>
+#include <tr1/unordered_map>
 
 #include "irc/channel.h"
 #include "irc/server.h"
@@ -37,6 +38,18 @@ namespace irc
 
 		map<im::ChatBuddy, ChanUser*> cbuddies;
 
+		/** Secondary indexes of cbuddies, by lowered name and by nick.
+		 *
+		 * The lowered name is kept with the key, as libpurple may have
+		 * freed the chat buddy when it is removed.
+		 */
+		typedef std::pair<im::ChatBuddy, string> BuddyKey;
+		std::tr1::unordered_map<string, ChanUser*> cbuddies_by_name;
+		std::tr1::unordered_map<const Nick*, BuddyKey> cbuddies_by_nick;
+
+		void indexBuddy(const im::ChatBuddy& cbuddy, ChanUser* chanuser);
+		void unindexBuddy(map<im::ChatBuddy, ChanUser*>::iterator it);
+
 	public:
 
 		ConversationChannel(IRC* irc, const im::Conversation& conv);
@@ -54,9 +67,13 @@ namespace irc
 		ChanUser* getChanUser(const im::ChatBuddy& cb) const;
 
 		void addBuddy(im::ChatBuddy cbuddy, int status = 0);
+
+		/** Add several chat buddies at once (see Channel::addUsers()). */
+		void addBuddies(const vector<im::ChatBuddy>& cbuddies);
 		void updateBuddy(im::ChatBuddy cbuddy);
 		void renameBuddy(ChanUser* chanuser, im::ChatBuddy cbuddy);
 		virtual void delUser(Nick* nick, Message message = Message());
+		virtual void delUsers(const std::tr1::unordered_set<Nick*>& nicks);
 
 		virtual string getTopic() const;
 
@@ -21,7 +21,7 @@
 #include <cstring>
 #include <algorithm>
 #include <fstream>
-#include <fnmatch.h>
+#include <tr1/unordered_set>
 
 #include "core/log.h"
 #include "core/util.h"
@@ -36,57 +36,70 @@
 namespace irc {
 
 IRC::command_t IRC::commands[] = {
-	{ MSG_NICK,    &IRC::m_nick,    0, 0, 0 },
-	{ MSG_USER,    &IRC::m_user,    4, 0, 0 },
-	{ MSG_PASS,    &IRC::m_pass,    1, 0, 0 },
-	{ MSG_QUIT,    &IRC::m_quit,    0, 0, 0 },
-	{ MSG_CMD,     &IRC::m_cmd,     2, 0, Nick::REGISTERED },
-	{ MSG_PRIVMSG, &IRC::m_privmsg, 2, 0, Nick::REGISTERED },
-	{ MSG_PING,    &IRC::m_ping,    0, 0, Nick::REGISTERED },
-	{ MSG_PONG,    &IRC::m_pong,    1, 0, Nick::REGISTERED },
-	{ MSG_VERSION, &IRC::m_version, 0, 0, Nick::REGISTERED },
-	{ MSG_INFO,    &IRC::m_info,    0, 0, Nick::REGISTERED },
-	{ MSG_WHO,     &IRC::m_who,     0, 0, Nick::REGISTERED },
-	{ MSG_WHOIS,   &IRC::m_whois,   1, 0, Nick::REGISTERED },
-	{ MSG_WHOWAS,  &IRC::m_whowas,  1, 0, Nick::REGISTERED },
-	{ MSG_STATS,   &IRC::m_stats,   0, 0, Nick::REGISTERED },
-	{ MSG_CONNECT, &IRC::m_connect, 1, 0, Nick::REGISTERED },
-	{ MSG_SCONNECT,&IRC::m_connect, 1, 0, Nick::REGISTERED },
-	{ MSG_SQUIT,   &IRC::m_squit,   1, 0, Nick::REGISTERED },
-	{ MSG_MAP,     &IRC::m_map,     0, 0, Nick::REGISTERED },
-	{ MSG_ADMIN,   &IRC::m_admin,   0, 0, Nick::REGISTERED },
-	{ MSG_JOIN,    &IRC::m_join,    1, 0, Nick::REGISTERED },
-	{ MSG_PART,    &IRC::m_part,    1, 0, Nick::REGISTERED },
-	{ MSG_NAMES,   &IRC::m_names,   1, 0, Nick::REGISTERED },
-	{ MSG_TOPIC,   &IRC::m_topic,   1, 0, Nick::REGISTERED },
-	{ MSG_LIST,    &IRC::m_list,    0, 0, Nick::REGISTERED },
-	{ MSG_MODE,    &IRC::m_mode,    1, 0, Nick::REGISTERED },
-	{ MSG_ISON,    &IRC::m_ison,    1, 0, Nick::REGISTERED },
-	{ MSG_INVITE,  &IRC::m_invite,  2, 0, Nick::REGISTERED },
-	{ MSG_KICK,    &IRC::m_kick,    2, 0, Nick::REGISTERED },
-	{ MSG_KILL,    &IRC::m_kill,    1, 0, Nick::REGISTERED },
-	{ MSG_SVSNICK, &IRC::m_svsnick, 2, 0, Nick::REGISTERED },
-	{ MSG_AWAY,    &IRC::m_away,    0, 0, Nick::REGISTERED },
-	{ MSG_MOTD,    &IRC::m_motd,    0, 0, Nick::REGISTERED },
-	{ MSG_OPER,    &IRC::m_oper,    2, 0, Nick::REGISTERED },
-	{ MSG_WALLOPS, &IRC::m_wallops, 1, 0, Nick::OPER },
-	{ MSG_REHASH,  &IRC::m_rehash,  0, 0, Nick::OPER },
-	{ MSG_DIE,     &IRC::m_die,     1, 0, Nick::OPER },
-	{ NULL,        NULL,            0, 0, 0 },
+	{ MSG_NICK,    &IRC::m_nick,    NULL,            0, 0, 0,                0, 0 },
+	{ MSG_USER,    &IRC::m_user,    NULL,            4, 0, 0,                0, 0 },
+	{ MSG_PASS,    &IRC::m_pass,    NULL,            1, 0, 0,                0, 0 },
+	{ MSG_QUIT,    &IRC::m_quit,    NULL,            0, 0, 0,                0, 0 },
+	{ MSG_CMD,     &IRC::m_cmd,     NULL,            2, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_PRIVMSG, NULL,            &IRC::m_privmsg, 2, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_PING,    NULL,            &IRC::m_ping,    0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_PONG,    NULL,            &IRC::m_pong,    1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_VERSION, &IRC::m_version, NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_INFO,    &IRC::m_info,    NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_WHO,     &IRC::m_who,     NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_WHOIS,   &IRC::m_whois,   NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_WHOWAS,  &IRC::m_whowas,  NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_STATS,   &IRC::m_stats,   NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_CONNECT, &IRC::m_connect, NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_SCONNECT,&IRC::m_connect, NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_SQUIT,   &IRC::m_squit,   NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_MAP,     &IRC::m_map,     NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_ADMIN,   &IRC::m_admin,   NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_JOIN,    &IRC::m_join,    NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_PART,    &IRC::m_part,    NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_NAMES,   &IRC::m_names,   NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_TOPIC,   &IRC::m_topic,   NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_LIST,    &IRC::m_list,    NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_MODE,    NULL,            &IRC::m_mode,    1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_ISON,    &IRC::m_ison,    NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_INVITE,  &IRC::m_invite,  NULL,            2, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_KICK,    &IRC::m_kick,    NULL,            2, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_KILL,    &IRC::m_kill,    NULL,            1, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_SVSNICK, &IRC::m_svsnick, NULL,            2, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_AWAY,    &IRC::m_away,    NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_MOTD,    &IRC::m_motd,    NULL,            0, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_OPER,    &IRC::m_oper,    NULL,            2, 0, Nick::REGISTERED, 0, 0 },
+	{ MSG_WALLOPS, &IRC::m_wallops, NULL,            1, 0, Nick::OPER,       0, 0 },
+	{ MSG_REHASH,  &IRC::m_rehash,  NULL,            0, 0, Nick::OPER,       0, 0 },
+	{ MSG_DIE,     &IRC::m_die,     NULL,            1, 0, Nick::OPER,       0, 0 },
+	{ NULL,        NULL,            NULL,            0, 0, 0,                0, 0 },
 };
 
+StaticStringIndex IRC::commands_index;
+
+/* Monotonic, so handler times don't wrap if the wall clock steps back. */
+static uint64_t now_usec()
+{
+	return (uint64_t)g_get_monotonic_time();
+}
+
 IRC::IRC(ServerPoll* _poll, sock::SockWrapper* _sockw, string _hostname, unsigned _ping_freq)
 	: Server("localhost.localdomain", MINBIF_VERSION),
 	  poll(_poll),
 	  sockw(_sockw),
 	  read_cb(NULL),
+	  error_cb(NULL),
+	  lines_cb(NULL),
+	  lines_id(-1),
 	  ping_id(-1),
 	  ping_freq(_ping_freq),
 	  uptime(time(NULL)),
 	  ping_cb(NULL),
 	  user(NULL),
 	  im(NULL),
-	  im_auth(NULL)
+	  im_auth(NULL),
+	  who_id(-1),
+	  who_cb(NULL)
 {
 	/* Get my own hostname (if not given in arguments) */
 	if(_hostname.empty() || _hostname == " ")
@@ -100,9 +113,21 @@ IRC::IRC(ServerPoll* _poll, sock::SockWrapper* _sockw, string _hostname, unsigne
 	else
 		setName(_hostname);
 
+	if(commands_index.empty())
+	{
+		vector<const char*> names;
+		for(size_t i = 0; commands[i].cmd != NULL; ++i)
+			names.push_back(commands[i].cmd);
+		commands_index.build(names);
+	}
+
 	/* create a callback on the sock. */
 	read_cb = new CallBack<IRC>(this, &IRC::readIO);
 	sockw->AttachCallback(PURPLE_INPUT_READ, read_cb);
+	error_cb = new CallBack<IRC>(this, &IRC::sockError);
+	lines_cb = new CallBack<IRC>(this, &IRC::processLines);
+	who_cb = new CallBack<IRC>(this, &IRC::processWho);
+	sockw->SetErrorCallback(error_cb);
 
 	/* Create main objects and root joins command channel. */
 	user = new User(sockw, this, "*", "", sockw->GetClientHostname());
@@ -132,6 +157,13 @@ IRC::~IRC()
 	if(sockw)
 		delete sockw;
 	delete read_cb;
+	delete error_cb;
+	if(lines_id >= 0)
+		g_source_remove(lines_id);
+	delete lines_cb;
+	if(who_id >= 0)
+		g_source_remove(who_id);
+	delete who_cb;
 	cleanUpNicks();
 	cleanUpServers();
 	cleanUpChannels();
@@ -214,63 +246,164 @@ void IRC::cleanUpChannels()
 	channels.clear();
 }
 
+void IRC::indexNick(Nick* nick)
+{
+	nick_index.insert(NickIndex::value_type(nick->getNickname(), nick));
+
+	Buddy* buddy = dynamic_cast<Buddy*>(nick);
+	if(buddy && buddy->getBuddy().isValid())
+		buddy_index[buddy->getBuddy().getPurpleBuddy()] = buddy;
+
+	ConvNick* cn = dynamic_cast<ConvNick*>(nick);
+	if(cn)
+		indexConvNick(cn);
+}
+
+void IRC::unindexNick(Nick* nick)
+{
+	std::pair<NickIndex::iterator, NickIndex::iterator> range = nick_index.equal_range(nick->getNickname());
+	for(NickIndex::iterator it = range.first; it != range.second; ++it)
+		if(it->second == nick)
+		{
+			nick_index.erase(it);
+			break;
+		}
+
+	Buddy* buddy = dynamic_cast<Buddy*>(nick);
+	if(buddy && buddy->getBuddy().isValid())
+	{
+		std::tr1::unordered_map<PurpleBuddy*, Buddy*>::iterator it = buddy_index.find(buddy->getBuddy().getPurpleBuddy());
+		if(it != buddy_index.end() && it->second == buddy)
+			buddy_index.erase(it);
+	}
+
+	ConvNick* cn = dynamic_cast<ConvNick*>(nick);
+	if(cn)
+		unindexConvNick(cn);
+}
+
+void IRC::indexConvNick(ConvNick* n)
+{
+	im::Conversation conv = n->getConversation();
+	if(!conv.isValid())
+		return;
+
+	map<string, Nick*>::const_iterator it = users.find(n->getNickname());
+	if(it == users.end() || it->second != n)
+		return;
+
+	conv_index[conv.getPurpleConversation()] = n;
+}
+
+void IRC::unindexConvNick(ConvNick* n)
+{
+	im::Conversation conv = n->getConversation();
+	if(!conv.isValid())
+		return;
+
+	std::tr1::unordered_map<PurpleConversation*, ConvNick*>::iterator it = conv_index.find(conv.getPurpleConversation());
+	if(it != conv_index.end() && it->second == n)
+		conv_index.erase(it);
+}
+
 void IRC::addNick(Nick* nick)
 {
-	if(users.find(nick->getNickname()) != users.end())
+	map<string, Nick*>::iterator it = users.find(nick->getNickname());
+	if(it != users.end())
+	{
 		b_log[W_DESYNCH] << "/!\\ User " << nick->getNickname() << " already exists!";
+		/* The displaced nick must not be found by getNick() anymore. */
+		unindexNick(it->second);
+	}
 	users[nick->getNickname()] = nick;
+	indexNick(nick);
 	nick->getServer()->addNick(nick);
 }
 
 void IRC::renameNick(Nick* nick, string newnick)
 {
+	unindexNick(nick);
 	users.erase(nick->getNickname());
 	nick->setNickname(newnick);
-	addNick(nick);
+	map<string, Nick*>::iterator it = users.find(newnick);
+	if(it != users.end())
+	{
+		b_log[W_DESYNCH] << "/!\\ User " << newnick << " already exists!";
+		unindexNick(it->second);
+	}
+	users[newnick] = nick;
+	indexNick(nick);
 }
 
-Nick* IRC::getNick(string nickname, bool case_sensitive) const
+Nick* IRC::getNick(const string& nickname, bool case_sensitive) const
 {
-	map<string, Nick*>::const_iterator it;
-	if(!case_sensitive)
-		nickname = strlower(nickname);
-	for(it = users.begin(); it != users.end() && (case_sensitive ? it->first : strlower(it->first)) != nickname; ++it)
-		;
+	if(case_sensitive)
+	{
+		map<string, Nick*>::const_iterator it = users.find(nickname);
+		return it == users.end() ? NULL : it->second;
+	}
 
-	if(it == users.end())
+	NickIndex::const_iterator it = nick_index.find(nickname);
+	if(it == nick_index.end())
 		return 0;
 
 	return it->second;
 }
 
+string IRC::getFreeNickname(const string& nickname, const Nick* self, bool reserve)
+{
+	Nick* n = getNick(nickname);
+	if(!n || n == self)
+	{
+		/* Nobody collides anymore, suffixes can be given again. */
+		if(reserve)
+			nick_suffixes.erase(nickname);
+		return nickname;
+	}
+
+	unsigned hint = 0;
+	std::tr1::unordered_map<string, unsigned, rfc1459_hash, rfc1459_equal>::const_iterator it = nick_suffixes.find(nickname);
+	if(it != nick_suffixes.end())
+		hint = it->second;
+
+	/* A renamed nick is scanned from the first suffix, to find its own
+	 * one if it still fits. */
+	unsigned last = reserve && !self ? hint : 0;
+	string candidate;
+	do
+	{
+		string suffix = ++last == 1 ? "_" : "_" + t2s(last);
+		candidate = nickname.substr(0, Nick::MAX_LENGTH - suffix.size()) + suffix;
+		n = getNick(candidate);
+	} while(n && n != self);
+
+	if(reserve && last > hint)
+		nick_suffixes[nickname] = last;
+	return candidate;
+}
+
 Buddy* IRC::getNick(const im::Buddy& buddy) const
 {
-	map<string, Nick*>::const_iterator it;
-	Buddy* nb = NULL;
-	for(it = users.begin();
-	    it != users.end() && (!(nb = dynamic_cast<Buddy*>(it->second)) || nb->getBuddy() != buddy);
-	    ++it)
-		;
+	if(!buddy.isValid())
+		return NULL;
 
-	if(it == users.end())
+	std::tr1::unordered_map<PurpleBuddy*, Buddy*>::const_iterator it = buddy_index.find(buddy.getPurpleBuddy());
+	if(it == buddy_index.end())
 		return NULL;
 	else
-		return nb;
+		return it->second;
 }
 
 ConvNick* IRC::getNick(const im::Conversation& conv) const
 {
-	map<string, Nick*>::const_iterator it;
-	ConvNick* n = NULL;
-	for(it = users.begin();
-	    it != users.end() && (!(n = dynamic_cast<ConvNick*>(it->second)) || n->getConversation() != conv);
-	    ++it)
-		;
+	if(!conv.isValid())
+		return NULL;
 
-	if(it == users.end())
+	std::tr1::unordered_map<PurpleConversation*, ConvNick*>::const_iterator it = conv_index.find(conv.getPurpleConversation());
+	if(it == conv_index.end())
 		return NULL;
 	else
-		return n;
+		return it->second;
 }
 
 vector<Nick*> IRC::matchNick(string pattern) const
@@ -290,12 +423,10 @@ vector<Nick*> IRC::matchNick(string pattern) const
 	else if (pattern.find('@') == string::npos)
 		pattern += "@*";
 
+	MaskMatcher mask(pattern);
 	for (it = users.begin(); it != users.end(); ++it)
-	{
-		string longname = it->second->getLongName();
-		if (!fnmatch(pattern.c_str(), longname.c_str(), FNM_NOESCAPE|FNM_CASEFOLD))
+		if (mask.match(it->second->getLongName()))
 			result.push_back(it->second);
-	}
 
 	return result;
 }
@@ -317,6 +448,7 @@ void IRC::removeNick(string nickname)
 					(*dcc)->setPeer(NULL);
 				++dcc;
 			}
+		unindexNick(it->second);
 		it->second->getServer()->removeNick(it->second);
 		delete it->second;
 		users.erase(it);
@@ -332,6 +464,10 @@ void IRC::cleanUpNicks()
 		delete it->second;
 	}
 	users.clear();
+	nick_index.clear();
+	nick_suffixes.clear();
+	buddy_index.clear();
+	conv_index.clear();
 }
 
 void IRC::addServer(Server* server)
@@ -353,16 +489,24 @@ void IRC::removeServer(string servername)
 	map<string, Server*>::iterator it = servers.find(servername);
 	if(it != servers.end())
 	{
-		/* Cleanup server's users */
-		for(map<string, Nick*>::iterator nt = users.begin(); nt != users.end();)
-			if(nt->second->getServer() == it->second)
-			{
-				delete nt->second;
-				users.erase(nt);
-				nt = users.begin();
-			}
-			else
-				++nt;
+		/* Cleanup server's users. Channels are purged in one pass
+		 * and clients get one netsplit QUIT per user, so the
+		 * nicks below are destroyed without notifying anybody.
+		 */
+		vector<Nick*> nicks = it->second->getNicks();
+		Nick::quitAll(nicks, "*.net *.split");
+
+		std::tr1::unordered_set<Nick*> removed(nicks.begin(), nicks.end());
+		for(vector<DCC*>::iterator dcc = dccs.begin(); dcc != dccs.end(); ++dcc)
+			if(removed.find((*dcc)->getPeer()) != removed.end())
+				(*dcc)->setPeer(NULL);
+
+		for(vector<Nick*>::iterator nt = nicks.begin(); nt != nicks.end(); ++nt)
+		{
+			unindexNick(*nt);
+			users.erase((*nt)->getNickname());
+			delete *nt;
+		}
 
 		delete it->second;
 		servers.erase(it);
@@ -414,6 +558,12 @@ void IRC::quit(string reason)
 	poll->kill(this);
 }
 
+bool IRC::sockError(void*)
+{
+	quit(sockw ? sockw->GetError() : "Connection error");
+	return false;
+}
+
 void IRC::sendWelcome()
 {
 	if(user->hasFlag(Nick::REGISTERED) || user->getNickname() == "*" ||
@@ -458,12 +608,14 @@ void IRC::sendWelcome()
 										  .addArg(MINBIF_VERSION)
 										  .addArg(Nick::UMODES)
 										  .addArg(Channel::CHMODES));
+		/* Static constants are copied, as t2s() takes a reference. */
 		user->send(Message(RPL_ISUPPORT).setSender(this).setReceiver(user).addArg("CMDS=MAP")
-				                                                  /* TODO it doesn't compile because g++ is crappy.
-										   * .addArg("NICKLEN=" + t2s(Nick::MAX_LENGTH)) */
+										  .addArg("NICKLEN=" + t2s((size_t)Nick::MAX_LENGTH))
 										  .addArg("CHANTYPES=#&")
 										  .addArg("PREFIX=(qohv)~@%+")
 										  .addArg("STATUSMSG=~@%+")
+										  .addArg("MODES=" + t2s((unsigned)Channel::MAX_MODES))
+										  .addArg("MAXTARGETS=" + t2s((unsigned)MAX_TARGETS))
 										  .addArg("are supported by this server"));
 
 		m_motd(Message());
@@ -524,56 +676,106 @@ bool IRC::readIO(void*)
 {
 	try
 	{
-		string sbuf, line;
+		sockw->Read();
+	}
+	catch (sock::SockError &e)
+	{
+		quit(e.Reason());
+		return true;
+	}
+
+	/* If lines are already waiting, the scheduled call will process
+	 * them in order. */
+	if(lines_id < 0)
+		processLines();
 
-		sbuf = sockw->Read();
+	return true;
+}
 
-		while((line = stringtok(sbuf, "\r\n")).empty() == false)
+bool IRC::processLines(void*)
+{
+	const char* line;
+	size_t len;
+	unsigned count = 0;
+
+	/* sockw is removed if a command closes the connection. */
+	while(sockw && count < MAX_LINES_PER_LOOP && sockw->ReadLine(line, len))
+	{
+		++count;
+
+		MessageParser parser;
+		if(!parser.parse(line, len))
+			continue;
+
+		if(b_log.getLoggedFlags() & W_PARSE)
+			b_log[W_PARSE] << "<< " << string(line, len);
+		int i = commands_index.find(parser.getCommand());
+
+		user->setLastReadNow();
+
+		if(i < 0)
+			user->send(Message(ERR_UNKNOWNCOMMAND).setSender(this)
+							   .setReceiver(user)
+							   .addArg(parser.getCommand())
+							   .addArg("Unknown command"));
+		else if(parser.countArgs() < commands[i].minargs)
+			user->send(Message(ERR_NEEDMOREPARAMS).setSender(this)
+							   .setReceiver(user)
+							   .addArg(parser.getCommand())
+							   .addArg("Not enough parameters"));
+		else if(commands[i].flags && !user->hasFlag(commands[i].flags))
 		{
-			Message m = Message::parse(line);
-			b_log[W_PARSE] << "<< " << line;
-			size_t i;
-			for(i = 0;
-			    commands[i].cmd != NULL && strcmp(commands[i].cmd, m.getCommand().c_str());
-			    ++i)
-				;
-
-			user->setLastReadNow();
-
-			if(commands[i].cmd == NULL)
-				user->send(Message(ERR_UNKNOWNCOMMAND).setSender(this)
-								   .setReceiver(user)
-								   .addArg(m.getCommand())
-								   .addArg("Unknown command"));
-			else if(m.countArgs() < commands[i].minargs)
-				user->send(Message(ERR_NEEDMOREPARAMS).setSender(this)
-								   .setReceiver(user)
-								   .addArg(m.getCommand())
-								   .addArg("Not enough parameters"));
-			else if(commands[i].flags && !user->hasFlag(commands[i].flags))
-			{
-				if(!user->hasFlag(Nick::REGISTERED))
-					user->send(Message(ERR_NOTREGISTERED).setSender(this)
-									     .setReceiver(user)
-									     .addArg("Register first"));
-				else
-					user->send(Message(ERR_NOPRIVILEGES).setSender(this)
-									    .setReceiver(user)
-									    .addArg("Permission Denied: Insufficient privileges"));
-			}
+			if(!user->hasFlag(Nick::REGISTERED))
+				user->send(Message(ERR_NOTREGISTERED).setSender(this)
+								     .setReceiver(user)
+								     .addArg("Register first"));
 			else
-			{
-				commands[i].count++;
-				(this->*commands[i].func)(m);
-			}
+				user->send(Message(ERR_NOPRIVILEGES).setSender(this)
+								    .setReceiver(user)
+								    .addArg("Permission Denied: Insufficient privileges"));
+		}
+		else
+		{
+			command_t& cmd = commands[i];
+			uint64_t start = now_usec();
+
+			cmd.count++;
+			if(cmd.parsed_func)
+				(this->*cmd.parsed_func)(parser);
+			else
+				(this->*cmd.func)(parser.toMessage());
+
+			uint64_t elapsed = now_usec() - start;
+			cmd.total_time += elapsed;
+			if(elapsed > cmd.max_time)
+				cmd.max_time = elapsed;
 		}
 	}
-	catch (sock::SockError &e)
+
+	/* Data already received by the socket layer doesn't wake the
+	 * socket up again, so read it now that lines left some room. */
+	if(sockw && !sockw->HasLine() && sockw->HasPendingData())
 	{
-		quit(e.Reason());
+		try
+		{
+			sockw->Read();
+		}
+		catch (sock::SockError &e)
+		{
+			quit(e.Reason());
+		}
 	}
 
-	return true;
+	/* Let libpurple run before processing remaining lines. */
+	if(sockw && (sockw->HasLine() || sockw->HasPendingData()))
+	{
+		if(lines_id < 0)
+			lines_id = g_timeout_add(0, g_callback, lines_cb);
+		return true;
+	}
+
+	lines_id = -1;
+	return false;
 }
 
 }; /* namespace irc */
@@ -22,13 +22,16 @@
 #include <stdint.h>
 #include <string>
 #include <map>
+#include <deque>
 #include <exception>
+#include <tr1/unordered_map>
 
 #include "message.h"
 #include "server.h"
 #include "im/auth.h"
 #include "sockwrap/sockwrap.h"
 #include "core/exception.h"
+#include "core/util.h"
 
 class _CallBack;
 class ServerPoll;
@@ -67,6 +70,9 @@ namespace irc
 		ServerPoll* poll;
 		sock::SockWrapper* sockw;
 		_CallBack *read_cb;
+		_CallBack *error_cb;
+		_CallBack *lines_cb;
+		int lines_id;
 		int ping_id;
 		time_t ping_freq;
 		time_t uptime;
@@ -75,6 +81,21 @@ namespace irc
 		im::IM* im;
 		im::Auth *im_auth;
 		map<string, Nick*> users;
+
+		/** Case-insensitive index of users, by nickname. */
+		typedef std::tr1::unordered_multimap<string, Nick*, rfc1459_hash, rfc1459_equal> NickIndex;
+		NickIndex nick_index;
+
+		/** Reverse indexes from IM objects to their IRC nicks. */
+		std::tr1::unordered_map<PurpleBuddy*, Buddy*> buddy_index;
+		std::tr1::unordered_map<PurpleConversation*, ConvNick*> conv_index;
+
+		/** Last suffix given to each colliding nickname. */
+		std::tr1::unordered_map<string, unsigned, rfc1459_hash, rfc1459_equal> nick_suffixes;
+
+		void indexNick(Nick* nick);
+		void unindexNick(Nick* nick);
+
 		map<string, Channel*> channels;
 		map<string, Server*> servers;
 		vector<DCC*> dccs;
@@ -84,11 +105,17 @@ namespace irc
 		{
 			const char* cmd;
 			void (IRC::*func)(Message);
+			/** Handler which only reads arguments, so the line
+			 * isn't copied into a Message (used instead of func). */
+			void (IRC::*parsed_func)(const MessageParser&);
 			size_t minargs;
 			unsigned count;
 			unsigned flags;
+			uint64_t total_time;    /**< cumulative handler time (usec) */
+			uint64_t max_time;      /**< longest handler call (usec) */
 		};
 		static command_t commands[];
+		static StaticStringIndex commands_index;
 
 		void cleanUpNicks();
 		void cleanUpChannels();
@@ -99,20 +126,57 @@ namespace irc
 		/** Callback when it receives a new incoming message from socket. */
 		bool readIO(void*);
 
+		/** Maximum number of lines processed in one main loop iteration. */
+		static const unsigned MAX_LINES_PER_LOOP = 32;
+
+		/** Maximum number of targets of a PRIVMSG. */
+		static const unsigned MAX_TARGETS = 4;
+
+		/** Process complete lines received from socket. */
+		bool processLines(void* = NULL);
+
+		/** Callback when the socket wrapper reports a broken connection. */
+		bool sockError(void*);
+
+		/** A WHO request being answered. */
+		struct who_query_t
+		{
+			string mask;
+			bool status;              /**< show status messages instead of real names */
+			string next;              /**< nickname to resume from */
+			unsigned count;           /**< replies sent */
+			vector<string> members;   /**< nicknames on the listed channel */
+			size_t pos;               /**< member to resume from */
+		};
+		std::deque<who_query_t> who_queries;
+		int who_id;
+		_CallBack* who_cb;
+
+		/** Maximum number of WHO replies sent in one main loop iteration. */
+		static const unsigned WHO_REPLIES_PER_LOOP = 64;
+
+		/** Maximum number of nicks matched by WHO in one main loop iteration. */
+		static const unsigned WHO_NICKS_PER_LOOP = 1024;
+
+		/** Send the next replies of pending WHO requests. */
+		bool processWho(void* = NULL);
+
+		void sendWhoReply(Nick* n, const string& channame, bool status);
+
 		bool check_channel_join(void*);
 
 		void m_nick(Message m);     /**< Handler for the NICK message */
 		void m_user(Message m);     /**< Handler for the USER message */
 		void m_pass(Message m);     /**< Handler for the PASS message */
 		void m_quit(Message m);     /**< Handler for the QUIT message */
-		void m_ping(Message m);     /**< Handler for the PING message */
-		void m_pong(Message m);     /**< Handler for the PONG message */
+		void m_ping(const MessageParser& m);  /**< Handler for the PING message */
+		void m_pong(const MessageParser& m);  /**< Handler for the PONG message */
 		void m_who(Message m);      /**< Handler for the WHO message */
 		void m_whois(Message m);    /**< Handler for the WHOIS message */
 		void m_whowas(Message m);   /**< Handler for the WHOWAS message */
 		void m_version(Message m);  /**< Handler for the VERSION message */
 		void m_info(Message m);     /**< Handler for the INFO message */
-		void m_privmsg(Message m);  /**< Handler for the PRIVMSG message */
+		void m_privmsg(const MessageParser& m);  /**< Handler for the PRIVMSG message */
 		void m_stats(Message m);    /**< Handler for the STATS message */
 		void m_connect(Message m);  /**< Handler for the CONNECT message */
 		void m_squit(Message m);    /**< Handler for the SQUIT message */
@@ -128,7 +192,7 @@ namespace irc
 		void m_join(Message m);     /**< Handler for the JOIN message */
 		void m_part(Message m);     /**< Handler for the PART message */
 		void m_list(Message m);     /**< Handler for the LIST message */
-		void m_mode(Message m);     /**< Handler for the MODE message */
+		void m_mode(const MessageParser& m);  /**< Handler for the MODE message */
 		void m_names(Message m);    /**< Handler for the NAMES message */
 		void m_topic(Message m);    /**< Handler for the TOPIC message */
 		void m_ison(Message m);     /**< Handler for the ISON message */
@@ -188,13 +252,36 @@ namespace irc
 		void setMotd(const string& path);
 
 		void addNick(Nick* nick);
-		Nick* getNick(string nick, bool case_sensitive = false) const;
+		Nick* getNick(const string& nick, bool case_sensitive = false) const;
 		Buddy* getNick(const im::Buddy& buddy) const;
 		ConvNick* getNick(const im::Conversation& c) const;
 		vector<Nick*> matchNick(string pattern) const;
+
+		/** Get a nickname which is not used by anyone else.
+		 *
+		 * Returns the nickname itself when it is free, otherwise it
+		 * appends a suffix, starting after the last one allocated for
+		 * this nickname. The result never exceeds Nick::MAX_LENGTH.
+		 *
+		 * @param nickname  wanted nickname
+		 * @param self  nick which can keep its own nickname
+		 * @param reserve  the caller registers the result; if false, suffixes
+		 *                 are tried from the first one and nothing is allocated,
+		 *                 so the same name is returned until nicks change.
+		 * @return  a free nickname
+		 */
+		string getFreeNickname(const string& nickname, const Nick* self = NULL, bool reserve = true);
 		void removeNick(string nick);
 		void renameNick(Nick* n, string newnick);
 
+		/** Update the conversation index of a nick.
+		 *
+		 * ConvNick calls them around a change of its conversation,
+		 * nothing is indexed if the nick isn't in the users list.
+		 */
+		void indexConvNick(ConvNick* n);
+		void unindexConvNick(ConvNick* n);
+
 		void addServer(Server* server);
 		Server* getServer(string server) const;
 		void removeServer(string server);
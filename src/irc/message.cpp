@@ -26,12 +26,12 @@
 
 namespace irc {
 
-string Message::StoredEntity::getName() const
+const string& Message::StoredEntity::getName() const
 {
 	return entity ? entity->getName() : name;
 }
 
-string Message::StoredEntity::getLongName() const
+const string& Message::StoredEntity::getLongName() const
 {
 	return entity ? entity->getLongName() : name;
 }
@@ -45,58 +45,108 @@ Message::~Message()
 {
 }
 
-string Message::format() const
+/* A parameter needs a ':' prefix if it contains spaces or starts with ':' */
+static inline bool needs_colon(const string& arg)
 {
-	string buf;
+	return arg.find(' ') != string::npos || arg.c_str()[0] == ':';
+}
+
+size_t Message::formatLength() const
+{
+	size_t len = cmd.size() + 2;
+
+	if(sender.isSet())
+		len += sender.getLongName().size() + 2;
+	if(receiver.isSet())
+		len += receiver.getName().size() + 1;
+
+	for(vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+		len += it->size() + (needs_colon(*it) ? 2 : 1);
 
+	return len;
+}
+
+void Message::format(string& buf) const
+{
 	if(sender.isSet())
-		buf = ":" + sender.getLongName() + " ";
+	{
+		buf += ':';
+		buf += sender.getLongName();
+		buf += ' ';
+	}
 
 	buf += cmd;
 	if(receiver.isSet())
-		buf += " " + receiver.getName();
+	{
+		buf += ' ';
+		buf += receiver.getName();
+	}
 
 	for(vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
 	{
-		buf += " ";
-		if(it->find(' ') != string::npos || it->c_str()[0] == ':')
-			buf += ":";
+		buf += ' ';
+		if(needs_colon(*it))
+			buf += ':';
 		buf += *it;
 	}
 
 	buf += "\r\n";
+}
+
+string Message::format() const
+{
+	string buf;
+
+	buf.reserve(formatLength());
+	format(buf);
 
 	return buf;
 }
 
+const string& Message::formatShared() const
+{
+	if(!formatted)
+	{
+		formatted.reset(new string);
+		formatted->reserve(formatLength());
+		format(*formatted);
+	}
+	return *formatted;
+}
+
 Message& Message::setCommand(string r)
 {
 	assert (r.empty() == false);
 
+	formatted.reset();
 	cmd = r;
 	return *this;
 }
 
 Message& Message::setSender(const Entity* entity)
 {
+	formatted.reset();
 	sender.setEntity(entity);
 	return *this;
 }
 
 Message& Message::setSender(string n)
 {
+	formatted.reset();
 	sender.setName(n);
 	return *this;
 }
 
 Message& Message::setReceiver(const Entity* entity)
 {
+	formatted.reset();
 	receiver.setEntity(entity);
 	return *this;
 }
 
 Message& Message::setReceiver(string n)
 {
+	formatted.reset();
 	receiver.setName(n);
 	return *this;
 }
@@ -106,6 +156,7 @@ Message& Message::addArg(string s)
 	if(!args.empty() && args.back().find(' ') != string::npos)
 		throw MalformedMessage();
 
+	formatted.reset();
 	args.push_back(s);
 	return *this;
 }
@@ -120,37 +171,89 @@ Message& Message::setArg(size_t i, string s)
 	if((i+1) < args.size() && args.back().find(' ') != string::npos)
 		throw MalformedMessage();
 
+	formatted.reset();
 	args[i] = s;
 	return *this;
 }
 
-string Message::getArg(size_t n) const
+const string& Message::getArg(size_t n) const
 {
 	assert(n < args.size());
 	return args[n];
 }
 
-Message Message::parse(string line)
+Message Message::parse(const string& line)
+{
+	MessageParser parser;
+	if(!parser.parse(line.data(), line.size()))
+		return Message();
+	return parser.toMessage();
+}
+
+bool MessageParser::parse(const char* line, size_t len)
 {
-	string s;
-	Message m;
-	while((s = stringtok(line, " ")).empty() == false)
+	const char* p = line;
+	const char* end = line + len;
+	const char* start;
+
+	nparams = 0;
+	cmd[0] = 0;
+
+	while(p < end && *p == ' ')
+		++p;
+	start = p;
+	while(p < end && *p != ' ')
+		++p;
+	if(p == start)
+		return false;
+
+	/* No command is that long, so a truncated one can't match. */
+	size_t n = p - start;
+	if(n > MAX_COMMAND_LEN)
+		n = MAX_COMMAND_LEN;
+	for(size_t i = 0; i < n; ++i)
+		cmd[i] = (start[i] >= 'a' && start[i] <= 'z') ? (char)(start[i] - 'a' + 'A') : start[i];
+	cmd[n] = 0;
+
+	while(p < end)
 	{
-		if(m.getCommand().empty())
-			m.setCommand(strupper(s));
-		else if(s[0] == ':')
+		while(p < end && *p == ' ')
+			++p;
+		if(p == end)
+			break;
+
+		/* The last parameter takes the rest of the line. */
+		if(*p == ':' || nparams == MAX_PARAMS - 1)
 		{
-			m.addArg(s.substr(1) + (line.empty() ? "" : " " + line));
+			if(*p == ':')
+				++p;
+			params[nparams++] = StrRef(p, end - p);
 			break;
 		}
-		else
-			m.addArg(s);
+
+		start = p;
+		while(p < end && *p != ' ')
+			++p;
+		params[nparams++] = StrRef(start, p - start);
 	}
+
+	return true;
+}
+
+Message MessageParser::toMessage() const
+{
+	Message m(cmd);
+
+	m.args.reserve(nparams);
+	for(size_t i = 0; i < nparams; ++i)
+		m.args.push_back(params[i].str());
+
 	return m;
 }
 
 void Message::rebuildWithQuotes()
 {
+	formatted.reset();
 	for(vector<string>::iterator s = args.begin(); s != args.end(); ++s)
 	{
 		if((*s)[0] == '"' && s->find(' ') == string::npos)
@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 #include <exception>
+#include <tr1/memory>
 
 #include "irc/replies.h"
 
@@ -33,6 +34,21 @@ namespace irc
 
 	class MalformedMessage : public std::exception {};
 
+	/** Part of a buffer, referenced without any copy. */
+	struct StrRef
+	{
+		const char* data;
+		size_t len;
+
+		StrRef() : data(NULL), len(0) {}
+		StrRef(const char* _data, size_t _len) : data(_data), len(_len) {}
+
+		bool empty() const { return len == 0; }
+		string str() const { return string(data, len); }
+	};
+
+	class MessageParser;
+
 	class Message
 	{
 		class StoredEntity
@@ -48,14 +64,17 @@ namespace irc
 
 			bool isSet() const { return entity || !name.empty(); }
 			const Entity* getEntity() const { return entity; }
-			string getName() const;
-			string getLongName() const;
+			const string& getName() const;
+			const string& getLongName() const;
 		};
 
 		string cmd;
 		StoredEntity sender;
 		StoredEntity receiver;
 		vector<string> args;
+		mutable std::tr1::shared_ptr<string> formatted;
+
+		friend class MessageParser;
 	public:
 
 		Message(string command);
@@ -73,13 +92,62 @@ namespace irc
 		string getCommand() const { return cmd; }
 		const Entity* getSender() const { return sender.getEntity(); }
 		const Entity* getReceiver() const { return receiver.getEntity(); }
-		string getArg(size_t n) const;
+		const string& getArg(size_t n) const;
 		size_t countArgs() const { return args.size(); }
-		vector<string> getArgs() const { return args; }
+		const vector<string>& getArgs() const { return args; }
+
+		/** Exact size of the formatted message. */
+		size_t formatLength() const;
+
+		/** Append the formatted message to a buffer. */
+		void format(string& buf) const;
 
 		string format() const;
+
+		/** Format the message once into a buffer shared by its copies.
+		 *
+		 * A message sent to several recipients is then formatted only
+		 * once. Any change to the message drops the buffer.
+		 */
+		const string& formatShared() const;
+		bool isFormatted() const { return formatted.get() != NULL; }
+
 		void rebuildWithQuotes();
-		static Message parse(string s);
+		static Message parse(const string& s);
+	};
+
+	/** Tokenize an IRC line in place.
+	 *
+	 * The command is upper-cased into an inline buffer, and parameters
+	 * only reference the parsed line, which has to outlive the parser.
+	 * Nothing is allocated until toMessage() is called.
+	 */
+	class MessageParser
+	{
+	public:
+		static const size_t MAX_PARAMS = 15;
+		static const size_t MAX_COMMAND_LEN = 31;
+
+	private:
+		char cmd[MAX_COMMAND_LEN + 1];
+		size_t nparams;
+		StrRef params[MAX_PARAMS];
+
+	public:
+		MessageParser() : nparams(0) { cmd[0] = 0; }
+
+		/** Parse a line, without the end of line characters.
+		 *
+		 * @return  false if there isn't any command.
+		 */
+		bool parse(const char* line, size_t len);
+
+		const char* getCommand() const { return cmd; }
+		size_t countArgs() const { return nparams; }
+		const StrRef& getArg(size_t n) const { return params[n]; }
+
+		/** Build a Message with copies of the command and parameters. */
+		Message toMessage() const;
 	};
 }; /* namespace irc */
 #endif /* IRC_MESSAGE_H */
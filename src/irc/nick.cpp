@@ -18,6 +18,8 @@
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
 
 #include "irc/nick.h"
 #include "irc/server.h"
@@ -47,6 +49,26 @@ Nick::~Nick()
 	quit("*.net *.split");
 }
 
+/* Characters allowed in nicknames, ie. in nick_lc_chars or nick_uc_chars. */
+const bool Nick::nick_chars[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
 bool Nick::isValidNickname(const string& nick)
 {
 	/* Empty/long nicks are not allowed, nor numbers at [0] */
@@ -54,7 +76,7 @@ bool Nick::isValidNickname(const string& nick)
 		return false;
 
 	for(string::const_iterator i = nick.begin(); i != nick.end(); ++i)
-		if(!strchr(Nick::nick_lc_chars, *i) && !strchr(Nick::nick_uc_chars, *i))
+		if(!nick_chars[(unsigned char)*i])
 			return false;
 
 	return true;
@@ -63,19 +85,31 @@ bool Nick::isValidNickname(const string& nick)
 
 string Nick::nickize(const string& n)
 {
-	string nick;
-
-	/* Transliterate string. */
-	GIConv ic = g_iconv_open("ASCII//TRANSLIT", "UTF-8");
-	gchar* conv = g_convert_with_iconv(n.c_str(), n.size(), ic, NULL, NULL, NULL);
+	/* Chat rooms keep giving the same names. */
+	static LRUCache<string, string> memo(256);
+	const string* cached = memo.find(n);
+	if(cached)
+		return *cached;
+
+	/* Transliterate string. Opening a converter is expensive, so the
+	 * same one is used by every calls.
+	 */
+	static GIConv ic = g_iconv_open("ASCII//TRANSLIT", "UTF-8");
+	gchar* conv = NULL;
+	if(ic != (GIConv)-1)
+	{
+		conv = g_convert_with_iconv(n.c_str(), n.size(), ic, NULL, NULL, NULL);
+		if(!conv)
+			g_iconv(ic, NULL, NULL, NULL, NULL);
+	}
 
+	string nick;
 	for(const char* c = conv ? conv : n.c_str(); *c; ++c)
 		if (*c == ' ')
 			nick += "_";
-		else if (strchr(nick_lc_chars, *c) || strchr(nick_uc_chars, *c))
+		else if (nick_chars[(unsigned char)*c])
 			nick += *c;
 
-	g_iconv_close(ic);
 	g_free(conv);
 
 	if(isdigit(nick[0]))
@@ -88,12 +122,14 @@ string Nick::nickize(const string& n)
 	if (nick.empty())
 		nick = "Invalid";
 
+	memo.insert(n, nick);
 	return nick;
 }
 
 void Nick::setNickname(string n)
 {
 	setName(n);
+	longname.clear();
 }
 
 void Nick::setIdentname(string n)
@@ -102,6 +138,7 @@ void Nick::setIdentname(string n)
 		if(*i == ' ')
 			*i = '_';
 	identname = n;
+	longname.clear();
 }
 
 void Nick::setHostname(string n)
@@ -110,13 +147,21 @@ void Nick::setHostname(string n)
 		if(*i == ' ')
 			*i = '.';
 	hostname = n;
+	longname.clear();
 }
 
-string Nick::getLongName() const
+const string& Nick::getLongName() const
 {
-	return getNickname()  + "!" +
-	       getIdentname() + "@" +
-	       getHostname();
+	if(longname.empty())
+	{
+		longname.reserve(getName().size() + identname.size() + hostname.size() + 2);
+		longname += getName();
+		longname += '!';
+		longname += identname;
+		longname += '@';
+		longname += hostname;
+	}
+	return longname;
 }
 
 CacaImage Nick::getIcon() const
@@ -124,25 +169,15 @@ CacaImage Nick::getIcon() const
 	return CacaImage();
 }
 
-vector<ChanUser*> Nick::getChannels() const
-{
-	return channels;
-}
-
 bool Nick::isOn(const Channel* chan) const
 {
-	for(vector<ChanUser*>::const_iterator it = channels.begin(); it != channels.end(); ++it)
-		if((*it)->getChannel() == chan)
-			return true;
-	return false;
+	return chan_index.find(chan) != chan_index.end();
 }
 
 ChanUser* Nick::getChanUser(const Channel* chan) const
 {
-	for(vector<ChanUser*>::const_iterator it = channels.begin(); it != channels.end(); ++it)
-		if((*it)->getChannel() == chan)
-			return *it;
-	return NULL;
+	std::tr1::unordered_map<const Channel*, ChanUser*>::const_iterator it = chan_index.find(chan);
+	return it == chan_index.end() ? NULL : it->second;
 }
 
 ChanUser* Nick::join(Channel* chan, int status)
@@ -159,52 +194,51 @@ ChanUser* Nick::join(Channel* chan, int status)
 		return chanuser;
 	}
 
-	chanuser = chan->addUser(this, status);
-	channels.push_back(chanuser);
-	return chanuser;
+	return chan->addUser(this, status);
 }
 
 void Nick::part(Channel* chan, string message)
 {
+	if(!isOn(chan))
+		return;
+
 	Message m = Message(MSG_PART).setSender(this)
 				     .setReceiver(chan)
 				     .addArg(message);
-	for(vector<ChanUser*>::iterator it = channels.begin(); it != channels.end();)
-		if((*it)->getChannel() == chan)
-		{
-			ChanUser* chanuser = *it;
-			it = channels.erase(it);
-			send(m);
-			chanuser->getChannel()->delUser(this, m);
-			break;
-		}
-		else
-			++it;
+	chan->flushModes();
+	send(m);
+	chan->delUser(this, m);
+}
+
+void Nick::addChanUser(ChanUser* chanuser)
+{
+	chanuser->nick_pos = channels.size();
+	channels.push_back(chanuser);
+	chan_index[chanuser->getChannel()] = chanuser;
 }
 
 void Nick::removeChanUser(ChanUser* chanuser)
 {
-	for(vector<ChanUser*>::iterator it = channels.begin(); it != channels.end();)
-		if(*it == chanuser)
-			it = channels.erase(it);
-		else
-			++it;
+	std::tr1::unordered_map<const Channel*, ChanUser*>::iterator it = chan_index.find(chanuser->getChannel());
+	if(it == chan_index.end() || it->second != chanuser)
+		return;
+
+	chan_index.erase(it);
+	ChanUser* last = channels.back();
+	channels[chanuser->nick_pos] = last;
+	last->nick_pos = chanuser->nick_pos;
+	channels.pop_back();
 }
 
 void Nick::kicked(Channel* chan, ChanUser* from, string message)
 {
-	for(vector<ChanUser*>::iterator it = channels.begin(); it != channels.end();)
-		if((*it)->getChannel() == chan)
-		{
-			ChanUser* cu = *it;
-			it = channels.erase(it);
-			cu->getChannel()->delUser(this, Message(MSG_KICK).setSender(from)
-					                                 .setReceiver(cu->getChannel())
-									 .addArg(getNickname())
-									 .addArg(message));
-		}
-		else
-			++it;
+	if(!isOn(chan))
+		return;
+
+	chan->delUser(this, Message(MSG_KICK).setSender(from)
+					     .setReceiver(chan)
+					     .addArg(getNickname())
+					     .addArg(message));
 }
 
 void Nick::quit(string text)
@@ -213,23 +247,61 @@ void Nick::quit(string text)
 		                     .addArg(text);
 	vector<Nick*> sended;
 
-	for(vector<ChanUser*>::iterator it = channels.begin(); it != channels.end();)
+	/* Channel::delUser() removes the channel from the list. */
+	while(!channels.empty())
 	{
-		vector<ChanUser*> users = (*it)->getChannel()->getChanUsers();
-		FOREACH(vector<ChanUser*>, users, u)
+		Channel* chan = channels.back()->getChannel();
+		chan->flushModes();
+		const vector<ChanUser*>& users = chan->getChanUsers();
+		for(vector<ChanUser*>::const_iterator u = users.begin(); u != users.end(); ++u)
 		{
+			/* Only nicks attached to a socket care about QUITs. */
 			Nick* n = (*u)->getNick();
-			if(std::find(sended.begin(), sended.end(), n) == sended.end())
+			if(n->hasSocket() && std::find(sended.begin(), sended.end(), n) == sended.end())
 			{
 				sended.push_back(n);
 				n->send(m);
 			}
 		}
-		(*it)->getChannel()->delUser(this);
-		it = channels.erase(it);
+		chan->delUser(this);
 	}
 }
 
+void Nick::quitAll(const vector<Nick*>& nicks, string text)
+{
+	std::tr1::unordered_set<Nick*> quitting(nicks.begin(), nicks.end());
+	std::tr1::unordered_map<Channel*, vector<Nick*> > listeners;
+
+	for(vector<Nick*>::const_iterator n = nicks.begin(); n != nicks.end(); ++n)
+	{
+		Message m = Message(MSG_QUIT).setSender(*n)
+			                     .addArg(text);
+		vector<Nick*> sended;
+
+		FOREACH(vector<ChanUser*>, (*n)->channels, it)
+		{
+			Channel* chan = (*it)->getChannel();
+			std::tr1::unordered_map<Channel*, vector<Nick*> >::iterator l = listeners.find(chan);
+			if(l == listeners.end())
+			{
+				chan->flushModes();
+				l = listeners.insert(std::make_pair(chan, chan->getListeners())).first;
+			}
+
+			FOREACH(vector<Nick*>, l->second, u)
+				if(quitting.find(*u) == quitting.end() &&
+				   std::find(sended.begin(), sended.end(), *u) == sended.end())
+				{
+					sended.push_back(*u);
+					(*u)->send(m);
+				}
+		}
+	}
+
+	for(std::tr1::unordered_map<Channel*, vector<Nick*> >::iterator l = listeners.begin(); l != listeners.end(); ++l)
+		l->first->delUsers(quitting);
+}
+
 void Nick::privmsg(Channel* chan, string msg)
 {
 	string tmp;
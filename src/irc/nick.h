@@ -19,6 +19,7 @@
 #define IRC_NICK_H
 
 #include <map>
+#include <tr1/unordered_map>
 #include <purple.h>
 
 #include "core/entity.h"
@@ -41,15 +42,18 @@ namespace irc
 	class Nick : public Entity
 	{
 		string identname, hostname, realname;
+		mutable string longname;     /**< cache of getLongName() */
 		string away;
 		Server* server;
 		unsigned int flags;
 		vector<ChanUser*> channels;
+		std::tr1::unordered_map<const Channel*, ChanUser*> chan_index;
 
 	public:
 
 		static const char *nick_lc_chars;
 		static const char *nick_uc_chars;
+		static const bool nick_chars[256];
 		static const size_t MAX_LENGTH = 29;
 		static const char* UMODES;
 		static string nickize(const string& n);
@@ -78,6 +82,12 @@ namespace irc
 		/** Virtual method called when sending a message to this nick. */
 		virtual void send(Message m) {}
 
+		/** Is this nick attached to a socket?
+		 *
+		 * Other nicks only handle PRIVMSGs sent to them.
+		 */
+		virtual bool hasSocket() const { return false; }
+
 		/** User joins a channel
 		 *
 		 * @param chan  channel to join
@@ -92,6 +102,12 @@ namespace irc
 		 */
 		void part(Channel* chan, string message="");
 
+		/** Add an ChanUser in list, when nick is added on a channel.
+		 *
+		 * @param chanuser  ChanUser object
+		 */
+		void addChanUser(ChanUser* chanuser);
+
 		/** Remove an ChanUser from list.
 		 *
 		 * @param chanuser  ChanUser object
@@ -104,6 +120,17 @@ namespace irc
 		 */
 		void quit(string message="");
 
+		/** Several users quit network at once (netsplit).
+		 *
+		 * Every channels are cleaned up in one pass, and nicks attached
+		 * to a socket receive one QUIT per user they share a channel
+		 * with. Nicks are not destroyed.
+		 *
+		 * @param nicks  nicks which quit
+		 * @param message  quit message.
+		 */
+		static void quitAll(const vector<Nick*>& nicks, string message="");
+
 		/** Used has been kicked by someone else on a channel.
 		 *
 		 * @param chan  channel
@@ -137,7 +164,7 @@ namespace irc
 		virtual void m_mode(Nick* sender, Message m);
 
 		/** Get all channels user is on. */
-		vector<ChanUser*> getChannels() const;
+		const vector<ChanUser*>& getChannels() const { return channels; }
 
 		/** Check if user is on one specified channel.
 		 *
@@ -156,10 +183,13 @@ namespace irc
 		Server* getServer() const { return server; }
 
 		/** Get the full name representation of user.
+		 *
+		 * It is built once and cached until the nickname, ident or
+		 * hostname changes.
 		 *
 		 * @return  a string in form "nick!ident@hostname"
 		 */
-		virtual string getLongName() const;
+		virtual const string& getLongName() const;
 
 		string getNickname() const { return getName(); }
 		void setNickname(string n);
@@ -74,6 +74,7 @@
 #define ERR_NOSUCHNICK       "401"
 #define ERR_NOSUCHCHANNEL    "403"
 #define ERR_WASNOSUCHNICK    "406"
+#define ERR_TOOMANYTARGETS   "407"
 #define ERR_UNKNOWNCOMMAND   "421"
 #define ERR_NONICKNAMEGIVEN  "431"
 #define ERR_ERRONEUSNICKNAME "432"
@@ -127,5 +128,6 @@
 #define MSG_DIE              "DIE"
 #define MSG_OPER             "OPER"
 #define MSG_CMD              "CMD"
+#define MSG_ACCEPT           "ACCEPT"
 
 #endif /* IRC_REPLIES_H */
@@ -17,6 +17,11 @@
 
 #include "server.h"
 #include "nick.h"
+#include "buddy.h"
+#include "irc.h"
+#include "status_channel.h"
+#include "core/callback.h"
+#include "core/log.h"
 
 namespace irc {
 
@@ -27,17 +32,17 @@ Server::Server(string name, string _info)
 
 void Server::addNick(Nick* n)
 {
-	users.push_back(n);
+	users.insert(n);
 }
 
 void Server::removeNick(Nick* n)
 {
-	for(vector<Nick*>::iterator it = users.begin(); it != users.end(); ++it)
-		if (*it == n)
-		{
-			users.erase(it);
-			return;
-		}
+	users.erase(n);
+}
+
+vector<Nick*> Server::getNicks() const
+{
+	return vector<Nick*>(users.begin(), users.end());
 }
 
 unsigned Server::countNicks() const
@@ -48,7 +53,7 @@ unsigned Server::countNicks() const
 unsigned Server::countOnlineNicks() const
 {
 	unsigned i = 0;
-	for(vector<Nick*>::const_iterator it = users.begin(); it != users.end(); ++it)
+	for(std::tr1::unordered_set<Nick*>::const_iterator it = users.begin(); it != users.end(); ++it)
 		if((*it)->isOnline())
 			i++;
 	return i;
@@ -58,9 +63,90 @@ RemoteServer::RemoteServer(IRC* _irc, im::Account _account)
 	: Server(_account.getServername(),
 	         _account.getProtocol().getName()),
 	  account(_account),
-	  irc(_irc)
+	  irc(_irc),
+	  stale(false),
+	  expire_id(-1),
+	  expire_cb(NULL),
+	  presence_id(-1),
+	  presence_cb(NULL)
+{
+
+}
+
+RemoteServer::~RemoteServer()
+{
+	cancelExpiration();
+	if(presence_id >= 0)
+		g_source_remove(presence_id);
+	delete presence_cb;
+}
+
+void RemoteServer::setStale(unsigned delay)
+{
+	cancelExpiration();
+	stale = true;
+	expire_cb = new CallBack<RemoteServer>(this, &RemoteServer::expire);
+	expire_id = g_timeout_add(delay * 1000, g_callback, expire_cb);
+}
+
+void RemoteServer::cancelExpiration()
+{
+	if(expire_id >= 0)
+		g_source_remove(expire_id);
+	expire_id = -1;
+	delete expire_cb;
+	expire_cb = NULL;
+}
+
+bool RemoteServer::expire(void*)
+{
+	/* The source is removed by returning false, and this instance is
+	 * destroyed by removeServer(), so do not touch it anymore.
+	 */
+	expire_id = -1;
+	b_log[W_INFO|W_SNO] << "Closing link with " << getName();
+	irc->removeServer(getName());
+	return false;
+}
+
+void RemoteServer::updatePresence(Buddy* buddy, unsigned delay)
 {
+	if(presence_pending.insert(buddy).second)
+		presence_queue.push_back(buddy);
 
+	if(presence_id >= 0)
+		return;
+
+	if(!presence_cb)
+		presence_cb = new CallBack<RemoteServer>(this, &RemoteServer::flushPresence);
+	presence_id = g_timeout_add(delay, g_callback, presence_cb);
+}
+
+bool RemoteServer::flushPresence(void*)
+{
+	vector<Buddy*> queue;
+	vector<std::pair<Nick*, int> > joins;
+
+	presence_id = -1;
+	queue.swap(presence_queue);
+
+	/* Buddies removed meanwhile are not pending anymore. */
+	for(vector<Buddy*>::iterator it = queue.begin(); it != queue.end(); ++it)
+		if(presence_pending.erase(*it))
+			(*it)->getBuddy().updated(&joins);
+
+	StatusChannel* chan = account.getStatusChannel();
+	if(chan && !joins.empty())
+		chan->addUsers(joins);
+
+	return false;
+}
+
+void RemoteServer::removeNick(Nick* n)
+{
+	/* Left in presence_queue, and skipped by flushPresence(). */
+	presence_pending.erase(n);
+	Server::removeNick(n);
 }
 
 }; /* namespace irc */
@@ -19,21 +19,25 @@
 #define IRC_SERVER_H
 
 #include <vector>
+#include <tr1/unordered_set>
 
 #include "core/entity.h"
 #include "im/account.h"
 
+class _CallBack;
+
 namespace irc
 {
 	class IRC;
 	class Nick;
+	class Buddy;
 	using std::vector;
 
 	/** This class represents an IRC server */
 	class Server : public Entity
 	{
 		string info;
-		vector<Nick*> users;
+		std::tr1::unordered_set<Nick*> users;
 
 	public:
 
@@ -48,7 +52,10 @@ namespace irc
 		string getServerInfo() const { return info; }
 
 		void addNick(Nick* n);
-		void removeNick(Nick* n);
+		virtual void removeNick(Nick* n);
+
+		/** Get every nicks on this server. */
+		vector<Nick*> getNicks() const;
 
 		unsigned countNicks() const;
 		unsigned countOnlineNicks() const;
@@ -65,6 +72,16 @@ namespace irc
 	{
 		im::Account account;
 		IRC* irc;
+		bool stale;
+		int expire_id;
+		_CallBack* expire_cb;
+		vector<Buddy*> presence_queue;                    /**< may hold removed buddies */
+		std::tr1::unordered_set<Nick*> presence_pending;  /**< buddies really waiting in the queue */
+		int presence_id;
+		_CallBack* presence_cb;
+
+		bool expire(void*);
+		bool flushPresence(void*);
 
 	public:
 
@@ -74,10 +91,44 @@ namespace irc
 		 * @param account  IM account linked to this server.
 		 */
 		RemoteServer(IRC* irc, im::Account account);
+		~RemoteServer();
 
 		IRC* getIRC() const { return irc; }
 
 		im::Account getAccount() const { return account; }
+
+		/** The account has been disconnected, but nicks are kept
+		 * during a grace delay in case it comes back.
+		 *
+		 * The server is removed when the delay expires.
+		 *
+		 * @param delay  grace delay (s)
+		 */
+		void setStale(unsigned delay);
+
+		/** The account is back, cancel the removal.
+		 *
+		 * Nicks stay stale until they are reconciled.
+		 */
+		void cancelExpiration();
+
+		/** Nicks have been reconciled with the new presence. */
+		void setFresh() { stale = false; }
+
+		/** Are nicks left from a previous connection? */
+		bool isStale() const { return stale; }
+
+		/** Queue a presence update of a buddy.
+		 *
+		 * Every updates received during the delay are flushed at once,
+		 * so a buddy flapping between states only produces its net change.
+		 *
+		 * @param buddy  buddy to update
+		 * @param delay  coalescing delay (ms)
+		 */
+		void updatePresence(Buddy* buddy, unsigned delay);
+
+		virtual void removeNick(Nick* n);
 	};
 
 }; /* namespace irc */
@@ -22,6 +22,7 @@
 #include "status_channel.h"
 #include "nick.h"
 #include "buddy.h"
+#include "user.h"
 #include "im/im.h"
 #include "im/account.h"
 #include "core/util.h"
@@ -33,6 +34,33 @@ StatusChannel::StatusChannel(IRC* irc, string name)
 	: Channel(irc, name)
 {}
 
+void StatusChannel::broadcast(Message m, Nick* butone)
+{
+	if(m.getCommand() != MSG_PRIVMSG || m.countArgs() == 0)
+	{
+		Channel::broadcast(m, butone);
+		return;
+	}
+
+	flushModes();
+
+	User* user = irc->getUser();
+	if(user != butone && user->hasSocket() && user->isOn(this))
+		user->send(m);
+
+	/* Buddies only handle messages prefixed by their nickname (see
+	 * Buddy::send()), so the addressed one is looked up directly
+	 * instead of giving the message to every buddies. */
+	const string& text = m.getArg(0);
+	string::size_type pos = text.find(": ");
+	if(pos == string::npos || pos == 0)
+		return;
+
+	Nick* nick = irc->getNick(text.substr(0, pos), true);
+	if(nick && nick != butone && nick != user && nick->isOn(this))
+		nick->send(m);
+}
+
 void StatusChannel::addAccount(const im::Account& account)
 {
 	accounts.push_back(account);
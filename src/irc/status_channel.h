@@ -52,6 +52,13 @@ namespace irc
 		virtual void showBanList(Nick* to);
 
 		virtual void processBan(Nick* from, string pattern, bool add);
+
+		/** Broadcast a message on channel.
+		 *
+		 * A PRIVMSG is only routed to the local user and to the buddy
+		 * addressed with a "nick: " prefix.
+		 */
+		virtual void broadcast(Message m, Nick* butone = NULL);
 	};
 
 }; /* ns irc */
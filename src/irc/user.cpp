@@ -34,8 +34,24 @@ User::~User()
 
 void User::send(Message msg)
 {
-	if (sockw)
-		sockw->Write(msg.format());
+	if (!sockw)
+		return;
+
+	/* Already formatted for several recipients. */
+	if (msg.isFormatted())
+	{
+		sockw->Write(msg.formatShared());
+		return;
+	}
+
+	/* Format the message directly in the output queue. */
+	size_t len = msg.formatLength();
+	string* buf = sockw->ReserveWrite(len);
+	if (buf)
+	{
+		msg.format(*buf);
+		sockw->CommitWrite(len);
+	}
 }
 
 void User::setLastReadNow()
@@ -61,6 +61,8 @@ namespace irc
 		/** Send a message to file descriptor */
 		virtual void send(Message m);
 
+		virtual bool hasSocket() const { return sockw != NULL; }
+
 	};
 
 }; /* namespace irc */
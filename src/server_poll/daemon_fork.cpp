@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
 #include "daemon_fork.h"
@@ -34,6 +35,7 @@
 #include "core/log.h"
 #include "core/minbif.h"
 #include "core/util.h"
+#include "im/purple.h"
 #include "sockwrap/sock.h"
 #include "sockwrap/sockwrap.h"
 
@@ -41,7 +43,13 @@ DaemonForkServerPoll::DaemonForkServerPoll(Minbif* application, ConfigSection* c
 	: ServerPoll(application, config),
 	  irc(NULL),
 	  sock(-1),
-	  read_cb(NULL)
+	  read_cb(NULL),
+	  prefork(0),
+	  refill_id(-1),
+	  refill_cb(NULL),
+	  ipc_fd(-1),
+	  rotate_id(-1),
+	  rotate_cb(NULL)
 {
 	ConfigSection* section = getConfig();
 	if(section->Found() == false)
@@ -51,6 +59,7 @@ DaemonForkServerPoll::DaemonForkServerPoll(Minbif* application, ConfigSection* c
 	}
 
 	maxcon = section->GetItem("maxcon")->Integer();
+	prefork = section->GetItem("prefork")->Integer();
 
 	if(section->GetItem("background")->Boolean())
 	{
@@ -130,6 +139,24 @@ DaemonForkServerPoll::DaemonForkServerPoll(Minbif* application, ConfigSection* c
 	freeaddrinfo(addrinfo_bind);
 	if(!read_cb)
 		throw ServerPollError();
+
+	/* Children inherit TLS credentials instead of building their own. */
+	rotate_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::rotateKeys);
+	try
+	{
+		scheduleRotation(sock::SockWrapper::PrepareSecurity(getConfig()));
+	}
+	catch(StrException &e)
+	{
+		b_log[W_ERR] << "Unable to prepare connections security: " + e.Reason();
+		throw ServerPollError();
+	}
+
+	if(section->GetItem("preload_plugins")->Boolean())
+		im::Purple::preloadPlugins();
+
+	refill_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::refillPool);
+	scheduleRefill();
 }
 
 DaemonForkServerPoll::~DaemonForkServerPoll()
@@ -140,6 +167,13 @@ DaemonForkServerPoll::~DaemonForkServerPoll()
 	if(sock >= 0)
 		close(sock);
 
+	if(refill_id >= 0)
+		g_source_remove(refill_id);
+	delete refill_cb;
+	if(rotate_id >= 0)
+		g_source_remove(rotate_id);
+	delete rotate_cb;
+
 	delete irc;
 
 	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
@@ -163,7 +197,7 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 		return true;
 	}
 
-	if(maxcon > 0 && childs.size() >= (unsigned)maxcon)
+	if(maxcon > 0 && childs.size() - countIdle() >= (unsigned)maxcon)
 	{
 		static const char error[] = "ERROR :Closing Link: Too much connections on server\r\n";
 		send(new_socket, error, sizeof(error), 0);
@@ -171,6 +205,34 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 		return true;
 	}
 
+	/* A pre-forked worker takes the connection without any fork. */
+	if(handOff(new_socket))
+		return true;
+
+	child_t* child;
+	pid_t client_pid = forkChild(child);
+
+	if(client_pid < 0)
+	{
+		b_log[W_ERR] << "Unable to fork while receiving a new connection: " << strerror(errno);
+		close(new_socket);
+	}
+	else if(client_pid > 0)
+	{
+		/* Parent */
+		b_log[W_INFO] << "Creating new process with pid " << client_pid;
+		close(new_socket);
+	}
+	else
+		startIRC(new_socket);
+
+	return true;
+}
+
+pid_t DaemonForkServerPoll::forkChild(child_t*& child)
+{
+	child = NULL;
+
 	int fds[2];
 	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
 	{
@@ -183,23 +245,24 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 		sock_make_nonblocking(fds[1]);
 	}
 
-	pid_t client_pid = fork();
+	pid_t pid = fork();
 
-	if(client_pid < 0)
+	if(pid < 0)
 	{
-		b_log[W_ERR] << "Unable to fork while receiving a new connection: " << strerror(errno);
-		close(new_socket);
-		return true;
+		if(fds[0] >= 0)
+		{
+			close(fds[0]);
+			close(fds[1]);
+		}
 	}
-	else if(client_pid > 0)
+	else if(pid > 0)
 	{
 		/* Parent */
-		b_log[W_INFO] << "Creating new process with pid " << client_pid;
-		close(new_socket);
 		if(fds[0] >= 0)
 		{
-			child_t* child = new child_t();
+			child = new child_t();
 			child->fd = fds[0];
+			child->idle = false;
 			child->read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::ipc_read, child);
 			child->read_id = glib_input_add(child->fd, (PurpleInputCondition)PURPLE_INPUT_READ,
 						       g_callback_input, child->read_cb);
@@ -217,6 +280,13 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 		delete read_cb;
 		read_cb = NULL;
 
+		/* Only master refills the pool. The callback may be running. */
+		prefork = 0;
+		if(refill_id >= 0)
+			g_source_remove(refill_id);
+		refill_id = -1;
+		scheduleRotation(0);
+
 		if(fds[1] >= 0)
 		{
 			sock = fds[1];
@@ -235,30 +305,158 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 				delete child;
 			}
 		}
+	}
 
-		try
+	return pid;
+}
+
+void DaemonForkServerPoll::startIRC(int fd)
+{
+	try
+	{
+		irc = new irc::IRC(this, sock::SockWrapper::Builder(getConfig(), fd, fd),
+			      conf.GetSection("irc")->GetItem("hostname")->String(),
+			      conf.GetSection("irc")->GetItem("ping")->Integer());
+	}
+	catch(StrException &e)
+	{
+		b_log[W_ERR] << "Unable to start the IRC daemon: " + e.Reason();
+		getApplication()->quit();
+	}
+}
+
+unsigned DaemonForkServerPoll::countIdle() const
+{
+	unsigned count = 0;
+	for(vector<child_t*>::const_iterator it = childs.begin(); it != childs.end(); ++it)
+		if((*it)->idle)
+			count++;
+	return count;
+}
+
+void DaemonForkServerPoll::scheduleRefill()
+{
+	if(prefork > 0 && refill_id < 0)
+		refill_id = g_timeout_add(0, g_callback, refill_cb);
+}
+
+bool DaemonForkServerPoll::refillPool(void*)
+{
+	/* One fork per main loop iteration, to keep accepting meanwhile. */
+	if(countIdle() >= (unsigned)prefork)
+	{
+		refill_id = -1;
+		return false;
+	}
+
+	child_t* child;
+	pid_t pid = forkChild(child);
+
+	if(pid < 0)
+	{
+		b_log[W_ERR] << "Unable to fork a worker: " << strerror(errno);
+		refill_id = -1;
+		return false;
+	}
+	else if(pid > 0)
+	{
+		if(!child)
 		{
-			irc = new irc::IRC(this, sock::SockWrapper::Builder(getConfig(), new_socket, new_socket),
-				      conf.GetSection("irc")->GetItem("hostname")->String(),
-				      conf.GetSection("irc")->GetItem("ping")->Integer());
+			refill_id = -1;
+			return false;
 		}
-		catch(StrException &e)
+		b_log[W_INFO] << "Creating new worker with pid " << pid;
+		child->idle = true;
+		return true;
+	}
+
+	/* Worker waits for a connection on IPC, and can't without it. */
+	if(sock < 0)
+		getApplication()->quit();
+	return false;
+}
+
+bool DaemonForkServerPoll::handOff(int fd)
+{
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+	{
+		child_t* child = *it;
+		if(!child->idle)
+			continue;
+
+		/* The connection is passed along with an ACCEPT command. */
+		string msg = irc::Message(MSG_ACCEPT).format();
+		struct iovec iov;
+		iov.iov_base = const_cast<char*>(msg.data());
+		iov.iov_len = msg.size();
+
+		char control[CMSG_SPACE(sizeof fd)];
+		struct msghdr hdr;
+		memset(&hdr, 0, sizeof hdr);
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = control;
+		hdr.msg_controllen = sizeof control;
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof fd);
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+
+		/* Whatever happens, this worker is not idle anymore. A broken
+		 * one is removed when its IPC socket is closed. */
+		child->idle = false;
+		if(sendmsg(child->fd, &hdr, 0) != (ssize_t)msg.size())
 		{
-			b_log[W_ERR] << "Unable to start the IRC daemon: " + e.Reason();
-			getApplication()->quit();
+			b_log[W_WARNING] << "Unable to hand off connection to a worker: " << strerror(errno);
+			continue;
 		}
+
+		b_log[W_INFO] << "New connection handed off to a worker";
+		close(fd);
+		scheduleRefill();
+		return true;
 	}
+	return false;
+}
+
+bool DaemonForkServerPoll::rotateKeys(void*)
+{
+	sock::SockWrapper::RotateSecurityKeys();
+
+	/* Idle workers quit on REHASH, and new ones get the new keys. */
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+		if((*it)->idle)
+		{
+			(*it)->idle = false;
+			ipc_master_send(*it, irc::Message(MSG_REHASH));
+		}
+	scheduleRefill();
 	return true;
 }
 
+void DaemonForkServerPoll::scheduleRotation(int lifetime)
+{
+	if(rotate_id >= 0)
+		g_source_remove(rotate_id);
+	rotate_id = -1;
+
+	if(lifetime > 0)
+		rotate_id = g_timeout_add(lifetime * 1000, g_callback, rotate_cb);
+}
+
 DaemonForkServerPoll::ipc_cmds_t DaemonForkServerPoll::ipc_cmds[] = {
 	{ MSG_WALLOPS,    &DaemonForkServerPoll::m_wallops,  2 },
 	{ MSG_REHASH,     &DaemonForkServerPoll::m_rehash,   0 },
 	{ MSG_DIE,        &DaemonForkServerPoll::m_die,      2 },
 	{ MSG_OPER,       &DaemonForkServerPoll::m_oper,     1 },
 	{ MSG_USER,       &DaemonForkServerPoll::m_user,     1 },
+	{ MSG_ACCEPT,     &DaemonForkServerPoll::m_accept,   0 },
 };
 
+StaticStringIndex DaemonForkServerPoll::ipc_cmds_index;
+
 /** OPER nick
  *
  * A user on a minbif instance is now an IRC Operator
@@ -289,6 +487,13 @@ void DaemonForkServerPoll::m_wallops(child_t* child, irc::Message m)
  */
 void DaemonForkServerPoll::m_rehash(child_t* child, irc::Message m)
 {
+	/* An idle worker holds the old configuration and credentials, so
+	 * it is replaced by a new one. */
+	if(!child && !irc)
+	{
+		getApplication()->quit();
+		return;
+	}
 	rehash();
 }
 
@@ -325,6 +530,47 @@ void DaemonForkServerPoll::m_user(child_t* child, irc::Message m)
 	}
 }
 
+/** ACCEPT
+ *
+ * Master gives an accepted connection to an idle worker, with the
+ * descriptor attached (SCM_RIGHTS).
+ */
+void DaemonForkServerPoll::m_accept(child_t* child, irc::Message m)
+{
+	if(child || irc || ipc_fd < 0)
+		return;
+
+	int fd = ipc_fd;
+	ipc_fd = -1;
+	startIRC(fd);
+}
+
+/* Read an IPC line, and keep a descriptor sent along with it. */
+static ssize_t ipc_recv(int fd, char* buf, size_t len, int* passed_fd)
+{
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr hdr;
+	memset(&hdr, 0, sizeof hdr);
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control;
+	hdr.msg_controllen = sizeof control;
+
+	ssize_t r = recvmsg(fd, &hdr, 0);
+	if(r <= 0)
+		return r;
+
+	for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(passed_fd, CMSG_DATA(cmsg), sizeof *passed_fd);
+
+	return r;
+}
+
 bool DaemonForkServerPoll::ipc_read(void* data)
 {
 	child_t* child = NULL;
@@ -355,6 +601,8 @@ bool DaemonForkServerPoll::ipc_read(void* data)
 			g_source_remove(child->read_id);
 			delete child->read_cb;
 			delete child;
+
+			scheduleRefill();
 		}
 		else
 		{
@@ -365,6 +613,10 @@ bool DaemonForkServerPoll::ipc_read(void* data)
 			read_cb = NULL;
 			close(sock);
 			sock = -1;
+
+			/* An idle worker has nothing to serve without master. */
+			if(!irc)
+				getApplication()->quit();
 		}
 		return false;
 	}
@@ -376,17 +628,22 @@ bool DaemonForkServerPoll::ipc_read(void* data)
 	else
 		r = eol - buf + 2;
 
-	if(recv(fd, buf, r, 0) != r)
+	if(ipc_recv(fd, buf, r, &ipc_fd) != r)
 		return false;
 	buf[r - 2] = 0;
 
 	irc::Message m = irc::Message::parse(buf);
 
-	unsigned i = 0;
-	for(; i < (sizeof ipc_cmds / sizeof *ipc_cmds) && m.getCommand() != ipc_cmds[i].cmd; ++i)
-		;
+	if(ipc_cmds_index.empty())
+	{
+		vector<const char*> names;
+		for(size_t i = 0; i < (sizeof ipc_cmds / sizeof *ipc_cmds); ++i)
+			names.push_back(ipc_cmds[i].cmd);
+		ipc_cmds_index.build(names);
+	}
 
-	if(i >= (sizeof ipc_cmds / sizeof *ipc_cmds))
+	int i = ipc_cmds_index.find(m.getCommand().c_str());
+	if(i < 0)
 	{
 		b_log[W_WARNING] << "Received unknown command from IPC: " << buf;
 		return true;
@@ -400,6 +657,13 @@ bool DaemonForkServerPoll::ipc_read(void* data)
 
 	(this->*ipc_cmds[i].func)(child, m);
 
+	/* A descriptor not taken by the handler. */
+	if(ipc_fd >= 0)
+	{
+		close(ipc_fd);
+		ipc_fd = -1;
+	}
+
 	return true;
 }
 
@@ -468,7 +732,22 @@ void DaemonForkServerPoll::rehash()
 	if(irc)
 		irc->rehash();
 	else
+	{
+		try
+		{
+			scheduleRotation(sock::SockWrapper::PrepareSecurity(getConfig()));
+		}
+		catch(StrException &e)
+		{
+			b_log[W_ERR] << "Unable to rebuild connections security, keeping previous one: " + e.Reason();
+		}
+
+		/* Idle workers quit on REHASH, don't give them anything more. */
+		for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+			(*it)->idle = false;
 		ipc_master_broadcast(irc::Message(MSG_REHASH));
+		scheduleRefill();
+	}
 }
 
 void DaemonForkServerPoll::kill(irc::IRC* irc)
@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "poll.h"
+#include "core/util.h"
 
 namespace irc {
 	class IRC;
@@ -40,6 +41,7 @@ class DaemonForkServerPoll : public ServerPoll
 		int read_id;
 		_CallBack* read_cb;
 		string username;
+		bool idle;          /**< pre-forked worker waiting for a connection */
 	};
 
 	/** IPC commands array. */
@@ -49,6 +51,7 @@ class DaemonForkServerPoll : public ServerPoll
 		void (DaemonForkServerPoll::*func) (child_t* child, irc::Message m);
 		unsigned min_args;
 	} ipc_cmds[];
+	static StaticStringIndex ipc_cmds_index;
 
 	/** \page IPC
 	 *
@@ -65,6 +68,7 @@ class DaemonForkServerPoll : public ServerPoll
 	void m_die(child_t* child, irc::Message m);         /**< IPC handler for the DIE command. */
 	void m_oper(child_t* child, irc::Message m);        /**< IPC handler for the OPER command. */
 	void m_user(child_t* child, irc::Message m);        /**< IPC handler for the USER command. */
+	void m_accept(child_t* child, irc::Message m);      /**< IPC handler for the ACCEPT command. */
 
 	irc::IRC* irc;
 	int maxcon;
@@ -72,9 +76,44 @@ class DaemonForkServerPoll : public ServerPoll
 	int read_id;
 	_CallBack *read_cb;
 	vector<child_t*> childs;
+	int prefork;
+	int refill_id;
+	_CallBack* refill_cb;
+	int ipc_fd;             /**< descriptor received with the IPC command being processed */
+	int rotate_id;
+	_CallBack* rotate_cb;
 
 	bool ipc_read(void*);
 
+	/** Fork a child linked to master by an IPC socketpair.
+	 *
+	 * @param child  in master, set to the new child structure
+	 * @return  the fork() result.
+	 */
+	pid_t forkChild(child_t*& child);
+
+	/** Start the IRC server of a child on an accepted connection. */
+	void startIRC(int fd);
+
+	/** Count pre-forked workers waiting for a connection. */
+	unsigned countIdle() const;
+
+	/** Fork idle workers until there are prefork of them. */
+	bool refillPool(void* = NULL);
+	void scheduleRefill();
+
+	/** Give an accepted connection to an idle worker.
+	 *
+	 * @return  false if there is no idle worker able to take it.
+	 */
+	bool handOff(int fd);
+
+	/** Replace keys shared by connections, and idle workers which hold old ones. */
+	bool rotateKeys(void*);
+
+	/** (Re)arm the keys rotation timer, every lifetime seconds (0 to stop). */
+	void scheduleRotation(int lifetime);
+
 	/** Master sends a IPC message to a child.
 	 *
 	 * @param child  child data structure
@@ -17,6 +17,7 @@
  */
 
 #include <unistd.h>
+#include <cstring>
 
 #include "sockwrap.h"
 #include "sockwrap_plain.h"
@@ -24,19 +25,54 @@
 #  include "sockwrap_tls.h"
 #endif
 #include "core/util.h"
-#include <unistd.h>
+#include "sock.h"
 
 namespace sock
 {
 
+/* Lines are appended to the last block of the queue until it reaches
+ * this size, to keep the number of iovecs (and TLS records) low. */
+static const size_t SENDQ_BLOCK_SIZE = 16384;
+static const int SENDQ_MAX_IOV = 64;
+
 SockWrapper::SockWrapper(ConfigSection* _config, int _recv_fd, int _send_fd)
-	: config(_config), recv_fd(_recv_fd), send_fd(_send_fd)
+	: config(_config),
+	  sendq_offset(0),
+	  sendq_size(0),
+	  sendq_congested(false),
+	  write_id(-1),
+	  write_cb(NULL),
+	  recvq_start(0),
+	  recvq_end(0),
+	  recvq_scan(0),
+	  recvq_discard(false),
+	  recvq_full(false),
+	  error_cb(NULL),
+	  notify_cb(NULL),
+	  notify_id(-1),
+	  recv_fd(_recv_fd),
+	  send_fd(_send_fd),
+	  ready(true)
 {
 	if (recv_fd < 0)
 		throw SockError("Wrong input file descriptor");
 	if (send_fd < 0)
 		throw SockError("Wrong output file descriptor");
 
+	sendq_low = config->GetItem("sendq_low")->Integer() * 1024;
+	sendq_high = config->GetItem("sendq_high")->Integer() * 1024;
+	sendq_max = config->GetItem("sendq_max")->Integer() * 1024;
+	if (sendq_high > sendq_max)
+		sendq_high = sendq_max;
+	if (sendq_low > sendq_high)
+		sendq_low = sendq_high;
+
+	/* Output is queued and flushed when the socket is writable, so a
+	 * slow client can't block the whole process. */
+	sock_make_nonblocking(send_fd);
+	write_cb = new CallBack<SockWrapper>(this, &SockWrapper::FlushSendQ);
+	notify_cb = new CallBack<SockWrapper>(this, &SockWrapper::NotifyError);
+
 	sock_ok = true;
 }
 
@@ -44,6 +80,9 @@ SockWrapper::~SockWrapper()
 {
 	EndSessionCleanup();
 
+	delete write_cb;
+	delete notify_cb;
+
 	sock_ok = false;
 
 	b_log[W_SOCK] << "Closing sockets";
@@ -68,6 +107,34 @@ SockWrapper* SockWrapper::Builder(ConfigSection* _config, int _recv_fd, int _sen
 	throw SockError("unknown security mode");
 }
 
+int SockWrapper::PrepareSecurity(ConfigSection* _config)
+{
+#ifdef HAVE_TLS
+	if (_config->GetItem("security")->String().compare("tls") == 0)
+	{
+		SockWrapperTLS::InitCredentials(_config);
+		return SockWrapperTLS::GetTicketKeyLifetime(_config);
+	}
+#endif
+	return 0;
+}
+
+void SockWrapper::RotateSecurityKeys()
+{
+#ifdef HAVE_TLS
+	SockWrapperTLS::RotateTicketKey();
+#endif
+}
+
+bool SockWrapper::GetHandshakeStats(unsigned long& full, unsigned long& resumed)
+{
+#ifdef HAVE_TLS
+	return SockWrapperTLS::GetHandshakeStats(full, resumed);
+#else
+	return false;
+#endif
+}
+
 string SockWrapper::GetClientHostname()
 {
 	struct sockaddr_storage sock;
@@ -110,17 +177,311 @@ string SockWrapper::GetServerHostname()
 
 int SockWrapper::AttachCallback(PurpleInputCondition cond, _CallBack* cb)
 {
-	int id = glib_input_add(recv_fd, cond, g_callback_input, cb);
-	if (id > 0)
-		callback_ids.push_back(id);
+	/* Watched later by SetReady() if the session isn't established. */
+	int id = -1;
+	if (ready)
+	{
+		id = glib_input_add(recv_fd, cond, g_callback_input, cb);
+		if (id <= 0)
+			return id;
+	}
+
+	callback_t c;
+	c.cond = cond;
+	c.cb = cb;
+	c.id = id;
+	callbacks.push_back(c);
 	return id;
 }
 
+void SockWrapper::SetReady(bool _ready)
+{
+	if (ready == _ready)
+		return;
+
+	ready = _ready;
+	if (ready)
+	{
+		if (!sendq_congested && !recvq_full)
+			for(vector<callback_t>::iterator c = callbacks.begin(); c != callbacks.end(); ++c)
+				if (c->id < 0)
+					c->id = glib_input_add(recv_fd, c->cond, g_callback_input, c->cb);
+		if (sock_ok && sendq_size > 0 && write_id < 0)
+			write_id = glib_input_add(send_fd, PURPLE_INPUT_WRITE, g_callback_input, write_cb);
+	}
+	else
+	{
+		for(vector<callback_t>::iterator c = callbacks.begin(); c != callbacks.end(); ++c)
+			if (c->id > 0)
+			{
+				g_source_remove(c->id);
+				c->id = -1;
+			}
+		if (write_id > 0)
+			g_source_remove(write_id);
+		write_id = -1;
+	}
+}
+
 void SockWrapper::EndSessionCleanup()
 {
 	b_log[W_SOCK] << "Removing callbacks";
-	for(vector<int>::iterator id = callback_ids.begin(); id != callback_ids.end(); ++id)
-		g_source_remove(*id);
+	for(vector<callback_t>::iterator c = callbacks.begin(); c != callbacks.end(); ++c)
+		if (c->id > 0)
+			g_source_remove(c->id);
+	callbacks.clear();
+
+	if (write_id > 0)
+		g_source_remove(write_id);
+	write_id = -1;
+	if (notify_id > 0)
+		g_source_remove(notify_id);
+	notify_id = -1;
+}
+
+size_t SockWrapper::Read()
+{
+	if (!sock_ok)
+		return 0;
+
+	/* Move the incomplete line at the beginning of the buffer. */
+	if (recvq_start > 0)
+	{
+		memmove(recvq, recvq + recvq_start, recvq_end - recvq_start);
+		recvq_end -= recvq_start;
+		recvq_scan -= recvq_start;
+		recvq_start = 0;
+	}
+
+	if (recvq_end == RECVQ_SIZE)
+	{
+		/* Lines are still waiting to be processed: stop watching the
+		 * socket until ReadLine() has consumed all of them. */
+		if (HasLine())
+		{
+			if (!recvq_full)
+			{
+				recvq_full = true;
+				SuspendRead();
+			}
+			return 0;
+		}
+
+		b_log[W_SOCK] << "Input line too long, discarded";
+		recvq_end = recvq_scan = 0;
+		recvq_discard = true;
+	}
+
+	size_t r = ReadBuffer(recvq + recvq_end, RECVQ_SIZE - recvq_end);
+	recvq_end += r;
+	return r;
+}
+
+bool SockWrapper::HasLine() const
+{
+	/* Bytes before recvq_scan are already known not to end a line. */
+	while (recvq_scan < recvq_end && recvq[recvq_scan] != '\n' && recvq[recvq_scan] != '\r')
+		++recvq_scan;
+	return recvq_scan < recvq_end;
+}
+
+bool SockWrapper::ReadLine(const char*& line, size_t& len)
+{
+	while (HasLine())
+	{
+		size_t i = recvq_scan;
+		size_t start = recvq_start;
+		bool discard = recvq_discard;
+		recvq_start = recvq_scan = i + 1;
+		recvq_discard = false;
+
+		/* Skip empty lines (for example between \r and \n) and the end
+		 * of a too long line. */
+		if (i == start || discard)
+			continue;
+
+		line = recvq + start;
+		len = i - start;
+		return true;
+	}
+
+	if (recvq_start == recvq_end)
+		recvq_start = recvq_end = recvq_scan = 0;
+
+	/* Every line is processed, there is room to read again. */
+	if (recvq_full)
+	{
+		recvq_full = false;
+		ResumeRead();
+	}
+
+	return false;
+}
+
+void SockWrapper::SuspendRead()
+{
+	for(vector<callback_t>::iterator c = callbacks.begin(); c != callbacks.end(); ++c)
+		if ((c->cond & PURPLE_INPUT_READ) && c->id > 0)
+		{
+			g_source_remove(c->id);
+			c->id = -1;
+		}
+}
+
+void SockWrapper::ResumeRead()
+{
+	if (!ready || sendq_congested || recvq_full)
+		return;
+	for(vector<callback_t>::iterator c = callbacks.begin(); c != callbacks.end(); ++c)
+		if (c->id < 0)
+			c->id = glib_input_add(recv_fd, c->cond, g_callback_input, c->cb);
+}
+
+string* SockWrapper::ReserveWrite(size_t len)
+{
+	if (!sock_ok)
+		return NULL;
+
+	if (sendq_size + len > sendq_max)
+	{
+		SetError("Max SendQ exceeded");
+		return NULL;
+	}
+
+	if (sendq.empty() || sendq.back().size() + len > SENDQ_BLOCK_SIZE)
+	{
+		sendq.push_back(string());
+		sendq.back().reserve(len > SENDQ_BLOCK_SIZE ? len : SENDQ_BLOCK_SIZE);
+	}
+
+	return &sendq.back();
+}
+
+void SockWrapper::CommitWrite(size_t len)
+{
+	if (!sock_ok || len == 0)
+		return;
+
+	sendq_size += len;
+
+	if (write_id < 0 && ready)
+		write_id = glib_input_add(send_fd, PURPLE_INPUT_WRITE, g_callback_input, write_cb);
+
+	if (!sendq_congested && sendq_size > sendq_high)
+	{
+		b_log[W_SOCK] << "SendQ is above " << sendq_high << " bytes, stop reading client";
+		sendq_congested = true;
+		SuspendRead();
+	}
+}
+
+void SockWrapper::Write(const string& s)
+{
+	string* buf;
+
+	if (s.empty() || !(buf = ReserveWrite(s.size())))
+		return;
+
+	buf->append(s);
+	CommitWrite(s.size());
+}
+
+bool SockWrapper::FlushSendQ(void*)
+{
+	while (sock_ok && ready && sendq_size > 0)
+	{
+		struct iovec iov[SENDQ_MAX_IOV];
+		int iovcnt = 0;
+		for(std::deque<string>::iterator it = sendq.begin(); it != sendq.end() && iovcnt < SENDQ_MAX_IOV; ++it, ++iovcnt)
+		{
+			size_t offset = iovcnt ? 0 : sendq_offset;
+			iov[iovcnt].iov_base = const_cast<char*>(it->data() + offset);
+			iov[iovcnt].iov_len = it->size() - offset;
+		}
+
+		size_t r;
+		try
+		{
+			r = WriteBuffers(iov, iovcnt);
+		}
+		catch (SockError &e)
+		{
+			SetError(e.Reason());
+			break;
+		}
+
+		if (r == 0)
+			break;
+
+		sendq_size -= r;
+		r += sendq_offset;
+		while (!sendq.empty() && r >= sendq.front().size())
+		{
+			r -= sendq.front().size();
+			sendq.pop_front();
+		}
+		sendq_offset = r;
+	}
+
+	if (sendq_congested && sendq_size <= sendq_low)
+	{
+		b_log[W_SOCK] << "SendQ is below " << sendq_low << " bytes, resume reading client";
+		sendq_congested = false;
+		ResumeRead();
+	}
+
+	if (sendq_size > 0 && sock_ok && ready)
+		return true;
+
+	/* Nothing left to write, remove the watch. */
+	write_id = -1;
+	return false;
+}
+
+void SockWrapper::FlushLastData()
+{
+	/* Best effort: the socket is non-blocking, so whatever can't be
+	 * written right now is lost. */
+	if (sock_ok && sendq_size > 0)
+		FlushSendQ();
+
+	if (write_id > 0)
+		g_source_remove(write_id);
+	write_id = -1;
+}
+
+void SockWrapper::SetError(const string& reason)
+{
+	if (!sock_ok)
+		return;
+
+	b_log[W_SOCK] << "Connection error: " << reason;
+	sock_ok = false;
+	error = reason;
+	sendq.clear();
+	sendq_offset = sendq_size = 0;
+
+	if (error_cb && notify_id < 0)
+		notify_id = g_timeout_add(0, g_callback, notify_cb);
+}
+
+void SockWrapper::SetErrorCallback(_CallBack* cb)
+{
+	error_cb = cb;
+
+	/* The connection may be broken before anybody listens. */
+	if (error_cb && !sock_ok && notify_id < 0)
+		notify_id = g_timeout_add(0, g_callback, notify_cb);
+}
+
+bool SockWrapper::NotifyError(void*)
+{
+	notify_id = -1;
+
+	/* The callback probably destroys this object, so don't touch
+	 * anything after this call. */
+	error_cb->run();
+	return false;
 }
 
 string SockWrapper::GetClientUsername()
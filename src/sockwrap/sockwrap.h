@@ -20,6 +20,8 @@
 #include <netdb.h>
 #include <string>
 #include <vector>
+#include <deque>
+#include <sys/uio.h>
 #include "core/log.h"
 #include "core/config.h"
 #include "core/callback.h"
@@ -42,17 +44,138 @@ namespace sock
 	class SockWrapper
 	{
 		ConfigSection* config;
-		vector<int> callback_ids;
+
+		struct callback_t
+		{
+			PurpleInputCondition cond;
+			_CallBack* cb;
+			int id;
+		};
+		vector<callback_t> callbacks;
+
+		/** Output queue.
+		 *
+		 * Written lines are appended to a chain of blocks, which is
+		 * flushed with one writev() when the socket is writable.
+		 */
+		std::deque<string> sendq;
+		size_t sendq_offset;             /**< bytes of the first block already sent */
+		size_t sendq_size;               /**< pending bytes */
+		size_t sendq_low, sendq_high;    /**< watermarks used to suspend reading */
+		size_t sendq_max;                /**< the client is disconnected above this */
+		bool sendq_congested;
+		int write_id;
+		_CallBack* write_cb;
+
+		/** Input buffer.
+		 *
+		 * Data is read in large chunks, and an incomplete line at the
+		 * end of the buffer is kept until the next read.
+		 */
+		static const size_t RECVQ_SIZE = 16384;
+		char recvq[RECVQ_SIZE];
+		size_t recvq_start, recvq_end;
+		mutable size_t recvq_scan;       /**< no end of line between recvq_start and this */
+		bool recvq_discard;              /**< drop data until next end of line */
+		bool recvq_full;                 /**< reading is suspended until lines are processed */
+
+		_CallBack* error_cb;
+		_CallBack* notify_cb;
+		int notify_id;
+		string error;
+
+		bool FlushSendQ(void* = NULL);
+		bool NotifyError(void*);
+
+		/** Stop watching the socket for reading. */
+		void SuspendRead();
+
+		/** Watch the socket for reading again, unless the output or
+		 * input queue still holds it. */
+		void ResumeRead();
 
 	public:
 		static SockWrapper* Builder(ConfigSection* _config, int _recv_fd, int _send_fd);
+
+		/** Build state shared by all connections of the security mode
+		 * (TLS credentials), before any of them is accepted.
+		 *
+		 * @return  seconds before RotateSecurityKeys() has to be called, 0 if never.
+		 * @throw SockError  when it can't be built.
+		 */
+		static int PrepareSecurity(ConfigSection* _config);
+
+		/** Replace keys shared by connections (TLS session ticket key). */
+		static void RotateSecurityKeys();
+
+		/** Get handshake counters of all processes sharing the security state.
+		 *
+		 * @return  false if there isn't any secure connection.
+		 */
+		static bool GetHandshakeStats(unsigned long& full, unsigned long& resumed);
 		SockWrapper(ConfigSection* _config, int _recv_fd, int _send_fd);
 		virtual ~SockWrapper();
 
 		ConfigSection* getConfig() const { return config; }
 
-		virtual string Read() = 0;
-		virtual void Write(string s) = 0;
+		/** Read available data from socket into the input buffer.
+		 *
+		 * @return  number of bytes read.
+		 * @throw SockError  when the connection is broken.
+		 */
+		size_t Read();
+
+		/** Get the next complete line from the input buffer.
+		 *
+		 * The line is not copied: it points into the input buffer and
+		 * stays valid until the next call to Read().
+		 *
+		 * @param line  set to the line, without the end of line characters.
+		 * @param len  set to the line length.
+		 * @return  false if there isn't any complete line.
+		 */
+		bool ReadLine(const char*& line, size_t& len);
+
+		/** Is there a complete line in the input buffer? */
+		bool HasLine() const;
+
+		/** Is there data received but not yet read with Read()?
+		 *
+		 * Such data (for example TLS records already decrypted) does
+		 * not make the socket readable again.
+		 */
+		virtual bool HasPendingData() const { return false; }
+
+		/** Queue data to send to the client.
+		 *
+		 * It never blocks nor throws: if the socket is broken or if the
+		 * client is too slow to read the queue, the error callback is
+		 * called from the main loop.
+		 */
+		void Write(const string& s);
+
+		/** Get the output buffer to append data to.
+		 *
+		 * It avoids an intermediate copy: the caller appends exactly
+		 * len bytes to the returned buffer, and calls CommitWrite().
+		 *
+		 * @return  NULL if the connection is broken.
+		 */
+		string* ReserveWrite(size_t len);
+
+		/** Queue len bytes appended to the buffer got by ReserveWrite(). */
+		void CommitWrite(size_t len);
+
+		/** Number of bytes waiting to be sent. */
+		size_t GetSendQSize() const { return sendq_size; }
+
+		/** Set callback called when the connection has to be closed.
+		 *
+		 * The reason is available with GetError().
+		 */
+		void SetErrorCallback(_CallBack* cb);
+		string GetError() const { return error; }
+
 		virtual string GetClientHostname();
 		virtual string GetServerHostname();
 		virtual int AttachCallback(PurpleInputCondition cond, _CallBack* cb);
@@ -61,8 +184,37 @@ namespace sock
 	protected:
 		int recv_fd, send_fd;
 		bool sock_ok;
+		bool ready;                      /**< session is established (after a handshake) */
+
+		/** Hold or release read callbacks and the output queue.
+		 *
+		 * While the session is not ready (for example during a TLS
+		 * handshake), callbacks are registered but not watched, and
+		 * data is only queued.
+		 */
+		void SetReady(bool _ready);
 
 		virtual void EndSessionCleanup();
+
+		/** Read data from socket.
+		 *
+		 * @return  number of bytes read, 0 if it would block.
+		 * @throw SockError  when the connection is broken.
+		 */
+		virtual size_t ReadBuffer(char* buf, size_t len) = 0;
+
+		/** Write as much data as possible from buffers.
+		 *
+		 * @return  number of bytes written, 0 if it would block.
+		 * @throw SockError  when the connection is broken.
+		 */
+		virtual size_t WriteBuffers(const struct iovec* iov, int iovcnt) = 0;
+
+		/** Try to send remaining data before closing the socket. */
+		void FlushLastData();
+
+		/** Mark the connection as broken and tell owner from the main loop. */
+		void SetError(const string& reason);
 	};
 };
 
@@ -19,6 +19,7 @@
 #include "sockwrap_plain.h"
 #include "sock.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <cstring>
 
 namespace sock
@@ -32,56 +33,39 @@ SockWrapperPlain::SockWrapperPlain(ConfigSection* _config, int _recv_fd, int _se
 
 SockWrapperPlain::~SockWrapperPlain()
 {
+	FlushLastData();
 }
 
-string SockWrapperPlain::Read()
+size_t SockWrapperPlain::ReadBuffer(char* buf, size_t len)
 {
-	static char buf[1024];
-	string sbuf;
 	ssize_t r;
 
-	if (!sock_ok)
-		return "";
-
-	if ((r = read(recv_fd, buf, sizeof buf - 1)) <= 0)
+	if ((r = read(recv_fd, buf, len)) <= 0)
 	{
 		if (r == 0)
 			throw SockError("Connection reset by peer...");
 		else if(!sockerr_again())
 			throw SockError(string("Read error: ") + strerror(errno));
-		else
-			sbuf = "";
-	}
-	else
-	{
-		buf[r] = 0;
-		sbuf = buf;
+		return 0;
 	}
 
-	return sbuf;
+	return r;
 }
 
-void SockWrapperPlain::Write(string s)
+size_t SockWrapperPlain::WriteBuffers(const struct iovec* iov, int iovcnt)
 {
 	ssize_t r;
 
-	if (!sock_ok)
-		return;
-
-	if ((r = write(send_fd, s.c_str(), s.size())) <= 0)
+	if ((r = writev(send_fd, iov, iovcnt)) <= 0)
 	{
 		if (r == 0)
-		{
-			sock_ok = false;
 			throw SockError("Connection reset by peer...");
-		}
 		else if(!sockerr_again())
-		{
-			sock_ok = false;
-			throw SockError(string("Read error: ") + strerror(errno));
-		}
+			throw SockError(string("Write error: ") + strerror(errno));
+		return 0;
 	}
+
+	return r;
 }
 
 };
-
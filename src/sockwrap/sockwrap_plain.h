@@ -30,8 +30,9 @@ public:
 	SockWrapperPlain(ConfigSection* config, int _recv_fd, int _send_fd);
 	~SockWrapperPlain();
 
-	string Read();
-	void Write(string s);
+protected:
+	size_t ReadBuffer(char* buf, size_t len);
+	size_t WriteBuffers(const struct iovec* iov, int iovcnt);
 };
 
 };
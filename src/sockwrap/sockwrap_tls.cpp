@@ -18,8 +18,12 @@
 
 #include "sockwrap_tls.h"
 #include "sock.h"
+#include "core/util.h"
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <cstring>
+#include <cerrno>
+#include <glib.h>
 #include "gnutls/x509.h"
 
 namespace sock
@@ -30,72 +34,211 @@ static void tls_debug_message(int level, const char* message)
 	b_log[W_SOCK] << "TLS debug: " << message;
 }
 
-SockWrapperTLS::SockWrapperTLS(ConfigSection* _config, int _recv_fd, int _send_fd)
-	: SockWrapper(_config, _recv_fd, _send_fd)
+bool SockWrapperTLS::tls_init = false;
+gnutls_certificate_credentials_t SockWrapperTLS::x509_cred;
+gnutls_dh_params_t SockWrapperTLS::dh_params;
+gnutls_priority_t SockWrapperTLS::priority_cache;
+bool SockWrapperTLS::trust_check = false;
+gnutls_datum_t SockWrapperTLS::ticket_key = { NULL, 0 };
+SockWrapperTLS::handshake_stats_t* SockWrapperTLS::stats = NULL;
+
+static void check_tls_error(int tls_err)
 {
-	tls_ok = false;
-	trust_check = false;
+	if (tls_err != GNUTLS_E_SUCCESS)
+		throw TLSError(gnutls_strerror(tls_err));
+}
+
+static bool generate_ticket_key(gnutls_datum_t& key)
+{
+	int tls_err = gnutls_session_ticket_key_generate(&key);
+	if (tls_err != GNUTLS_E_SUCCESS)
+	{
+		b_log[W_ERR] << "Unable to generate a TLS session ticket key: " << gnutls_strerror(tls_err);
+		key.data = NULL;
+		key.size = 0;
+		return false;
+	}
+
+	b_log[W_SOCK] << "New TLS session ticket key";
+	return true;
+}
 
-	ConfigSection* c_section = getConfig()->GetSection("tls");
+void SockWrapperTLS::InitCredentials(ConfigSection* config)
+{
+	ConfigSection* c_section = config->GetSection("tls");
 	if (!c_section->Found())
 		throw TLSError("Missing section <inetd|daemon>/tls");
 
-	/* GNUTLS init */
-	b_log[W_SOCK] << "Initializing GNUTLS";
-	tls_err = gnutls_global_init();
-	CheckTLSError();
+	if (!tls_init)
+	{
+		/* GNUTLS init */
+		b_log[W_SOCK] << "Initializing GNUTLS";
+		check_tls_error(gnutls_global_init());
+
+		/* GNUTLS logging */
+		b_log[W_SOCK] << "Setting up GNUTLS logging";
+		gnutls_global_set_log_function(tls_debug_message);
+		gnutls_global_set_log_level(10);
+
+		/* Allocated before any fork, so children count in the same place. */
+		void* p = mmap(NULL, sizeof *stats, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+		{
+			static handshake_stats_t local_stats;
+			b_log[W_WARNING] << "Unable to share TLS counters: " << strerror(errno);
+			p = &local_stats;
+		}
+		stats = static_cast<handshake_stats_t*>(p);
+		stats->full = stats->resumed = 0;
+	}
 
-	/* GNUTLS logging */
-	b_log[W_SOCK] << "Setting up GNUTLS logging";
-	gnutls_global_set_log_function(tls_debug_message);
-	gnutls_global_set_log_level(10);
+	gnutls_certificate_credentials_t new_cred = NULL;
+	gnutls_dh_params_t new_dh = NULL;
+	gnutls_priority_t new_priority = NULL;
+	bool new_trust_check = false;
+	int tls_err;
 
-	b_log[W_SOCK] << "Setting up GNUTLS certificates";
-	tls_err = gnutls_certificate_allocate_credentials(&x509_cred);
-	CheckTLSError();
-	string trust_file = c_section->GetItem("trust_file")->String();
-	if (trust_file != " ")
+	try
+	{
+		b_log[W_SOCK] << "Setting up GNUTLS certificates";
+		check_tls_error(gnutls_certificate_allocate_credentials(&new_cred));
+		string trust_file = c_section->GetItem("trust_file")->String();
+		if (trust_file != " ")
+		{
+			tls_err = gnutls_certificate_set_x509_trust_file(new_cred,
+				trust_file.c_str(), GNUTLS_X509_FMT_PEM);
+			if (tls_err == GNUTLS_E_SUCCESS)
+				throw TLSError("trust file is empty or does not contain any valid CA certificate");
+			else if (tls_err < 0)
+				check_tls_error(tls_err);
+			new_trust_check = true;
+		}
+		string crl_file = c_section->GetItem("crl_file")->String();
+		if (new_trust_check && crl_file != " ")
+		{
+			tls_err = gnutls_certificate_set_x509_crl_file(new_cred,
+				crl_file.c_str(), GNUTLS_X509_FMT_PEM);
+			if (tls_err == GNUTLS_E_SUCCESS)
+				b_log[W_WARNING] << "trust file is empty or does not contain any valid CA certificate";
+			else if (tls_err < 0)
+				check_tls_error(tls_err);
+		}
+		check_tls_error(gnutls_certificate_set_x509_key_file(new_cred,
+			c_section->GetItem("cert_file")->String().c_str(),
+			c_section->GetItem("key_file")->String().c_str(),
+			GNUTLS_X509_FMT_PEM));
+
+		b_log[W_SOCK] << "Setting up GNUTLS DH params";
+		check_tls_error(gnutls_dh_params_init(&new_dh));
+		string dh_file = c_section->GetItem("dh_params_file")->String();
+		if (dh_file != " ")
+		{
+			gnutls_datum_t pem;
+			gchar* contents;
+			gsize length;
+			if (!g_file_get_contents(dh_file.c_str(), &contents, &length, NULL))
+				throw TLSError("unable to read DH parameters file " + dh_file);
+			pem.data = (unsigned char*)contents;
+			pem.size = length;
+			tls_err = gnutls_dh_params_import_pkcs3(new_dh, &pem, GNUTLS_X509_FMT_PEM);
+			g_free(contents);
+			check_tls_error(tls_err);
+		}
+		else
+			check_tls_error(gnutls_dh_params_generate2(new_dh, 1024));
+		gnutls_certificate_set_dh_params(new_cred, new_dh);
+
+		b_log[W_SOCK] << "Setting up GNUTLS priorities";
+		tls_err = gnutls_priority_init(&new_priority, c_section->GetItem("priority")->String().c_str(), NULL);
+		if (tls_err == GNUTLS_E_INVALID_REQUEST)
+			throw TLSError("syntax error in tls_priority parameter");
+		check_tls_error(tls_err);
+	}
+	catch (TLSError &e)
 	{
-		tls_err = gnutls_certificate_set_x509_trust_file(x509_cred,
-			trust_file.c_str(), GNUTLS_X509_FMT_PEM);
-		if (tls_err == GNUTLS_E_SUCCESS)
-			throw TLSError("trust file is empty or does not contain any valid CA certificate");
-		else if (tls_err < 0)
-			CheckTLSError();
-		trust_check = true;
+		if (new_priority)
+			gnutls_priority_deinit(new_priority);
+		if (new_cred)
+			gnutls_certificate_free_credentials(new_cred);
+		if (new_dh)
+			gnutls_dh_params_deinit(new_dh);
+		throw;
 	}
-	string crl_file = c_section->GetItem("crl_file")->String();
-	if (trust_check && crl_file != " ")
+
+	if (tls_init)
 	{
-		tls_err = gnutls_certificate_set_x509_crl_file(x509_cred,
-			crl_file.c_str(), GNUTLS_X509_FMT_PEM);
-		if (tls_err == GNUTLS_E_SUCCESS)
-			b_log[W_WARNING] << "trust file is empty or does not contain any valid CA certificate";
-		else if (tls_err < 0)
-			CheckTLSError();
+		gnutls_priority_deinit(priority_cache);
+		gnutls_certificate_free_credentials(x509_cred);
+		gnutls_dh_params_deinit(dh_params);
 	}
-	tls_err = gnutls_certificate_set_x509_key_file(x509_cred,
-		c_section->GetItem("cert_file")->String().c_str(),
-		c_section->GetItem("key_file")->String().c_str(),
-		GNUTLS_X509_FMT_PEM);
-	CheckTLSError();
+	x509_cred = new_cred;
+	dh_params = new_dh;
+	priority_cache = new_priority;
+	trust_check = new_trust_check;
+	tls_init = true;
+
+	/* Tickets issued with the previous key can't be used anymore. */
+	gnutls_datum_t key = { NULL, 0 };
+	if (c_section->GetItem("session_tickets")->Boolean())
+		generate_ticket_key(key);
+	gnutls_free(ticket_key.data);
+	ticket_key = key;
+}
 
-	b_log[W_SOCK] << "Setting up GNUTLS DH params";
-	tls_err = gnutls_dh_params_init(&dh_params);
-	CheckTLSError();
-	tls_err = gnutls_dh_params_generate2(dh_params, 1024);
-	CheckTLSError();
-	gnutls_certificate_set_dh_params(x509_cred, dh_params);
+void SockWrapperTLS::RotateTicketKey()
+{
+	gnutls_datum_t key;
+	if (!ticket_key.data || !generate_ticket_key(key))
+		return;
+
+	gnutls_free(ticket_key.data);
+	ticket_key = key;
+}
+
+int SockWrapperTLS::GetTicketKeyLifetime(ConfigSection* config)
+{
+	ConfigSection* c_section = config->GetSection("tls");
+	if (!ticket_key.data || !c_section->Found())
+		return 0;
+	return c_section->GetItem("ticket_key_lifetime")->Integer();
+}
+
+bool SockWrapperTLS::GetHandshakeStats(unsigned long& full, unsigned long& resumed)
+{
+	if (!stats)
+		return false;
+
+	full = stats->full;
+	resumed = stats->resumed;
+	return true;
+}
+
+SockWrapperTLS::SockWrapperTLS(ConfigSection* _config, int _recv_fd, int _send_fd)
+	: SockWrapper(_config, _recv_fd, _send_fd),
+	  handshake_id(-1),
+	  handshake_cb(NULL),
+	  handshake_timeout_id(-1),
+	  handshake_timeout_cb(NULL)
+{
+	tls_ok = false;
+	tls_handshake = false;
+
+	/* Inherited from the daemon master, or built for this only session. */
+	if (!tls_init)
+		InitCredentials(getConfig());
 
 	b_log[W_SOCK] << "Setting up GNUTLS session";
 	tls_err = gnutls_init(&tls_session, GNUTLS_SERVER);
 	CheckTLSError();
-	tls_err = gnutls_priority_set_direct(tls_session, c_section->GetItem("priority")->String().c_str(), NULL);
-	if (tls_err == GNUTLS_E_INVALID_REQUEST)
-		throw TLSError("syntax error in tls_priority parameter");
+	tls_err = gnutls_priority_set(tls_session, priority_cache);
 	CheckTLSError();
 	tls_err = gnutls_credentials_set(tls_session, GNUTLS_CRD_CERTIFICATE, x509_cred);
 	CheckTLSError();
+	if (ticket_key.data)
+	{
+		tls_err = gnutls_session_ticket_enable_server(tls_session, &ticket_key);
+		CheckTLSError();
+	}
 	gnutls_transport_set_ptr2(tls_session, (gnutls_transport_ptr_t) recv_fd, (gnutls_transport_ptr_t) send_fd);
 	if (trust_check)
 	{
@@ -103,30 +246,94 @@ SockWrapperTLS::SockWrapperTLS(ConfigSection* _config, int _recv_fd, int _send_f
 		gnutls_certificate_server_set_request(tls_session, GNUTLS_CERT_REQUEST);
 	}
 
-	ProcessTLSHandshake();
+	/* Nothing is read nor sent in clear until the handshake is done. */
+	sock_make_nonblocking(recv_fd);
+	handshake_timeout = getConfig()->GetSection("tls")->GetItem("handshake_timeout")->Integer();
+	handshake_cb = new CallBack<SockWrapperTLS>(this, &SockWrapperTLS::ProcessTLSHandshake);
+	handshake_timeout_cb = new CallBack<SockWrapperTLS>(this, &SockWrapperTLS::TLSHandshakeTimeout);
+	StartTLSHandshake();
+}
+
+SockWrapperTLS::~SockWrapperTLS()
+{
+	FlushLastData();
+	EndSessionCleanup();
 
-	b_log[W_SOCK] << "SSL connection initialized";
-	tls_ok = true;
+	delete handshake_cb;
+	delete handshake_timeout_cb;
 }
 
-void SockWrapperTLS::ProcessTLSHandshake()
+void SockWrapperTLS::StartTLSHandshake()
 {
 	b_log[W_SOCK] << "Starting GNUTLS handshake";
 	tls_handshake = false;
-	tls_err = -1;
-	while (tls_err != GNUTLS_E_SUCCESS)
+	SetReady(false);
+
+	if (handshake_timeout > 0 && handshake_timeout_id < 0)
+		handshake_timeout_id = g_timeout_add(handshake_timeout * 1000, g_callback, handshake_timeout_cb);
+
+	ProcessTLSHandshake();
+}
+
+bool SockWrapperTLS::ProcessTLSHandshake(void*)
+{
+	/* The watch is replaced at each step, as direction may change. */
+	handshake_id = -1;
+	if (!sock_ok)
+		return false;
+
+	tls_err = gnutls_handshake(tls_session);
+	if (tls_err == GNUTLS_E_SUCCESS)
 	{
-		tls_err = gnutls_handshake (tls_session);
-		if (gnutls_error_is_fatal(tls_err))
+		StopTLSHandshake();
+		tls_handshake = true;
+		tls_ok = true;
+		if (gnutls_session_is_resumed(tls_session))
+		{
+			__sync_fetch_and_add(&stats->resumed, 1);
+			b_log[W_SOCK] << "SSL connection initialized (session resumed)";
+		}
+		else
 		{
-			b_log[W_SOCK] << "TLS handshake failed: " << gnutls_strerror(tls_err);
-			throw TLSError("TLS initialization failed");
+			__sync_fetch_and_add(&stats->full, 1);
+			b_log[W_SOCK] << "SSL connection initialized";
 		}
+		SetReady(true);
+		return false;
+	}
 
-		if (tls_err != GNUTLS_E_SUCCESS)
-			usleep(100);
+	if (gnutls_error_is_fatal(tls_err))
+	{
+		StopTLSHandshake();
+		b_log[W_SOCK] << "TLS handshake failed: " << gnutls_strerror(tls_err);
+		SetError("TLS initialization failed");
+		return false;
 	}
-	tls_handshake = true;
+
+	/* Wait until the socket is ready in the direction GnuTLS is blocked on. */
+	if (gnutls_record_get_direction(tls_session))
+		handshake_id = glib_input_add(send_fd, PURPLE_INPUT_WRITE, g_callback_input, handshake_cb);
+	else
+		handshake_id = glib_input_add(recv_fd, PURPLE_INPUT_READ, g_callback_input, handshake_cb);
+	return false;
+}
+
+bool SockWrapperTLS::TLSHandshakeTimeout(void*)
+{
+	handshake_timeout_id = -1;
+	StopTLSHandshake();
+	SetError("TLS handshake timed out");
+	return false;
+}
+
+void SockWrapperTLS::StopTLSHandshake()
+{
+	if (handshake_id > 0)
+		g_source_remove(handshake_id);
+	handshake_id = -1;
+	if (handshake_timeout_id > 0)
+		g_source_remove(handshake_timeout_id);
+	handshake_timeout_id = -1;
 }
 
 void SockWrapperTLS::CheckTLSError()
@@ -140,87 +347,90 @@ void SockWrapperTLS::EndSessionCleanup()
 	sock_ok = false;
 
 	SockWrapper::EndSessionCleanup();
+	StopTLSHandshake();
 
 	if (tls_handshake && tls_ok)
 		gnutls_bye (tls_session, GNUTLS_SHUT_WR);
 	tls_ok = false;
 
 	gnutls_deinit(tls_session);
+}
 
-	gnutls_certificate_free_credentials(x509_cred);
-	gnutls_global_deinit();
+bool SockWrapperTLS::HasPendingData() const
+{
+	return tls_ok && tls_handshake && gnutls_record_check_pending(tls_session) > 0;
 }
 
-string SockWrapperTLS::Read()
+size_t SockWrapperTLS::ReadBuffer(char* buf, size_t len)
 {
-	static char buf[1024];
-	string sbuf = "";
-	ssize_t r = GNUTLS_E_AGAIN;
+	size_t total = 0;
 
-	if (!sock_ok || !tls_ok || !tls_handshake)
-		return "";
+	if (!tls_ok || !tls_handshake)
+		return 0;
 
-	while (tlserr_again(r))
+	/* Records already decrypted by GnuTLS don't wake the socket up,
+	 * so get them now. */
+	do
 	{
-		r = gnutls_record_recv(tls_session, buf, sizeof buf - 1);
+		ssize_t r = gnutls_record_recv(tls_session, buf + total, len - total);
 		if (r <= 0)
 		{
-			sock_ok = false;
 			if (r == 0)
 			{
 				tls_ok = false;
 				throw SockError("Connection reset by peer...");
 			}
-			else if (gnutls_error_is_fatal(r))
+			else if (r == GNUTLS_E_REHANDSHAKE)
+				StartTLSHandshake();
+			else if (!tlserr_again(r))
 			{
+				tls_ok = false;
 				tls_err = r;
 				CheckTLSError();
 			}
-			else if (r == GNUTLS_E_REHANDSHAKE)
-			{
-				ProcessTLSHandshake();
-				return "";
-			}
-			else
-				usleep(100);
-		}
-		else
-		{
-			buf[r] = 0;
-			sbuf = buf;
+			break;
 		}
-	}
+		total += r;
+	} while (total < len && gnutls_record_check_pending(tls_session) > 0);
 
-	return sbuf;
+	return total;
 }
 
-void SockWrapperTLS::Write(string s)
+size_t SockWrapperTLS::WriteBuffers(const struct iovec* iov, int iovcnt)
 {
-	ssize_t r = GNUTLS_E_AGAIN;
+	size_t written = 0;
 
-	if (!sock_ok || !tls_ok || !tls_handshake)
-		return;
+	if (!tls_ok || !tls_handshake)
+		return 0;
 
-	while (tlserr_again(r))
+	/* GnuTLS has no writev(), so blocks are sent one record at a time.
+	 * When a send is interrupted, GnuTLS keeps the record, and it is
+	 * resumed at next call as the head of the queue is unchanged. */
+	for (int i = 0; i < iovcnt; ++i)
 	{
-		r = gnutls_record_send(tls_session, s.c_str(), s.size());
+		ssize_t r = gnutls_record_send(tls_session, iov[i].iov_base, iov[i].iov_len);
 		if (r <= 0)
 		{
-			sock_ok = false;
 			if (r == 0)
 			{
 				tls_ok = false;
 				throw SockError("Connection reset by peer...");
 			}
-			else if (gnutls_error_is_fatal(r))
+			else if (tlserr_again(r))
+				break;
+			else
 			{
+				tls_ok = false;
 				tls_err = r;
 				CheckTLSError();
 			}
-			else
-				usleep(100);
 		}
+		written += r;
+		if ((size_t)r < iov[i].iov_len)
+			break;
 	}
+
+	return written;
 }
 
 string SockWrapperTLS::GetClientUsername()
@@ -35,25 +35,73 @@ public:
 
 class SockWrapperTLS : public SockWrapper
 {
-	gnutls_certificate_credentials_t x509_cred;
-	gnutls_dh_params_t dh_params;
+	/* Shared by every session of the process, and inherited by forked children. */
+	static bool tls_init;
+	static gnutls_certificate_credentials_t x509_cred;
+	static gnutls_dh_params_t dh_params;
+	static gnutls_priority_t priority_cache;
+	static bool trust_check;
+	static gnutls_datum_t ticket_key;      /**< session ticket key, empty when tickets are disabled */
+
+	/** Counters in memory shared by the master and its children. */
+	struct handshake_stats_t
+	{
+		unsigned long full;
+		unsigned long resumed;
+	};
+	static handshake_stats_t* stats;
+
 	gnutls_session_t tls_session;
 	bool tls_handshake;
 	bool tls_ok;
-	bool trust_check;
 
 	int tls_err;
 
+	/** Handshake is driven by socket readiness, and limited in time. */
+	int handshake_id;
+	_CallBack* handshake_cb;
+	int handshake_timeout;
+	int handshake_timeout_id;
+	_CallBack* handshake_timeout_cb;
+
 	void EndSessionCleanup();
-	void ProcessTLSHandshake();
+	void StartTLSHandshake();
+	bool ProcessTLSHandshake(void* = NULL);
+	bool TLSHandshakeTimeout(void*);
+	void StopTLSHandshake();
 	void CheckTLSError();
 
 public:
 	SockWrapperTLS(ConfigSection* config, int _recv_fd, int _send_fd);
+	~SockWrapperTLS();
+
+	/** Build credentials, priority cache and DH parameters.
+	 *
+	 * Previous ones are replaced only when everything succeeds, so
+	 * a failed rebuild keeps the server working.
+	 *
+	 * @param config  section which contains the 'tls' subsection
+	 */
+	static void InitCredentials(ConfigSection* config);
+
+	/** Generate a new session ticket key, if tickets are enabled.
+	 *
+	 * Sessions created after this call issue and accept tickets
+	 * with the new key only.
+	 */
+	static void RotateTicketKey();
+
+	/** @return  seconds before the ticket key has to be rotated, 0 if never. */
+	static int GetTicketKeyLifetime(ConfigSection* config);
+
+	static bool GetHandshakeStats(unsigned long& full, unsigned long& resumed);
 
-	string Read();
-	void Write(string s);
 	virtual string GetClientUsername();
+	virtual bool HasPendingData() const;
+
+protected:
+	size_t ReadBuffer(char* buf, size_t len);
+	size_t WriteBuffers(const struct iovec* iov, int iovcnt);
 };
 
 };
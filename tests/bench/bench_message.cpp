@@ -0,0 +1,97 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009-2010 Romain Bignon, Marc Dequènes (Duck)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Microbenchmark of IRC messages parsing and formatting.
+ *
+ * Usage: bench_message [iterations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+
+#include "irc/message.h"
+#include "core/entity.h"
+
+using namespace irc;
+
+static const char* lines[] = {
+	"PRIVMSG #minbif :hello world, this is a quite common message",
+	"privmsg romain :a message with   several    spaces and a : inside",
+	"MODE #minbif +ooo romain duck foo",
+	"WHO #minbif",
+	"PING :localhost.localdomain",
+	"JOIN #a,#b,#c,#d,#e",
+	"CMD a b c d e f g h i j k l m n o p q r s t :trailing parameter",
+};
+static const size_t nlines = sizeof lines / sizeof *lines;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char* name, double start, unsigned long ops, size_t check)
+{
+	double t = now() - start;
+	printf("%-24s %10lu ops  %8.1f ns/op  (%lu)\n", name, ops, t * 1e9 / ops, (unsigned long)check);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	vector<string> input;
+	size_t check;
+	double start;
+
+	for(size_t i = 0; i < nlines; ++i)
+		input.push_back(lines[i]);
+
+	check = 0;
+	start = now();
+	for(unsigned long n = 0; n < iterations; ++n)
+		for(size_t i = 0; i < nlines; ++i)
+		{
+			MessageParser parser;
+			parser.parse(input[i].data(), input[i].size());
+			check += parser.countArgs();
+		}
+	report("MessageParser::parse", start, iterations * nlines, check);
+
+	check = 0;
+	start = now();
+	for(unsigned long n = 0; n < iterations; ++n)
+		for(size_t i = 0; i < nlines; ++i)
+			check += Message::parse(input[i]).countArgs();
+	report("Message::parse", start, iterations * nlines, check);
+
+	Entity sender("romain!romain@localhost");
+	Entity receiver("#minbif");
+	Message m = Message(MSG_PRIVMSG).setSender(&sender)
+	                                .setReceiver(&receiver)
+	                                .addArg("hello world, this is a quite common message");
+	check = 0;
+	start = now();
+	for(unsigned long n = 0; n < iterations * nlines; ++n)
+		check += m.format().size();
+	report("Message::format", start, iterations * nlines, check);
+
+	return 0;
+}
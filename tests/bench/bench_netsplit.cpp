@@ -0,0 +1,294 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009-2010 Romain Bignon, Marc Dequènes (Duck)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Benchmark of a netsplit: every buddies of an account leave a crowded
+ * status channel, as done by IRC::removeServer().
+ *
+ * Usage: bench_netsplit [nicks]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <sys/time.h>
+
+#include "irc/server.h"
+#include "irc/channel.h"
+#include "irc/nick.h"
+#include "irc/replies.h"
+
+using namespace irc;
+
+class BenchServer : public Server
+{
+public:
+	BenchServer() : Server("bench.minbif", "Benchmark server") {}
+	virtual IRC* getIRC() const { return NULL; }
+};
+
+class BenchChannel : public Channel
+{
+public:
+	BenchChannel() : Channel(NULL, "&minbif") {}
+	virtual bool invite(Nick*, const string&, const string&) { return false; }
+	virtual bool kick(ChanUser*, ChanUser*, const string&) { return false; }
+	virtual void showBanList(Nick*) {}
+	virtual void processBan(Nick*, string, bool) {}
+};
+
+/* Client attached to a socket: it formats everything it receives. */
+class BenchUser : public Nick
+{
+public:
+	bool listening;
+	unsigned long received;
+
+	BenchUser(Server* server)
+		: Nick(server, "romain", "romain", "localhost"),
+		  listening(false),
+		  received(0)
+	{}
+
+	virtual bool hasSocket() const { return listening; }
+	virtual void send(Message m)
+	{
+		string buf;
+		m.format(buf);
+		received++;
+	}
+};
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Previous implementation, kept here as the reference: members are
+ * vectors searched linearly, every nick quits on its own from its
+ * destructor, and IRC::removeServer() rescans its nicks map from the
+ * beginning after each deletion. */
+namespace legacy
+{
+	class Nick;
+	class Channel;
+
+	struct ChanUser
+	{
+		Channel* chan;
+		Nick* nick;
+		ChanUser(Channel* c, Nick* n) : chan(c), nick(n) {}
+		Channel* getChannel() const { return chan; }
+		Nick* getNick() const { return nick; }
+	};
+
+	class Server
+	{
+	public:
+		vector<Nick*> users;
+
+		void addNick(Nick* n) { users.push_back(n); }
+		void removeNick(Nick* n)
+		{
+			for(vector<Nick*>::iterator it = users.begin(); it != users.end(); ++it)
+				if (*it == n)
+				{
+					users.erase(it);
+					return;
+				}
+		}
+	};
+
+	class Channel
+	{
+		vector<ChanUser*> users;
+
+	public:
+		vector<ChanUser*> getChanUsers() const { return users; }
+		ChanUser* addUser(Nick* nick)
+		{
+			ChanUser* chanuser = new ChanUser(this, nick);
+			users.push_back(chanuser);
+			return chanuser;
+		}
+		void delUser(Nick* nick, Message m = Message());
+	};
+
+	class Nick : public Entity
+	{
+		Server* server;
+		vector<ChanUser*> channels;
+
+	public:
+		Nick(Server* _server, string name) : Entity(name), server(_server) {}
+		virtual ~Nick() { quit("*.net *.split"); }
+
+		Server* getServer() const { return server; }
+		virtual void send(Message m) {}
+
+		void join(Channel* chan) { channels.push_back(chan->addUser(this)); }
+		void quit(string text)
+		{
+			Message m = Message(MSG_QUIT).setSender(this)
+						     .addArg(text);
+			vector<Nick*> sended;
+
+			for(vector<ChanUser*>::iterator it = channels.begin(); it != channels.end();)
+			{
+				vector<ChanUser*> users = (*it)->getChannel()->getChanUsers();
+				FOREACH(vector<ChanUser*>, users, u)
+				{
+					Nick* n = (*u)->getNick();
+					if(std::find(sended.begin(), sended.end(), n) == sended.end())
+					{
+						sended.push_back(n);
+						n->send(m);
+					}
+				}
+				(*it)->getChannel()->delUser(this);
+				it = channels.erase(it);
+			}
+		}
+	};
+
+	void Channel::delUser(Nick* nick, Message m)
+	{
+		for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); )
+			if((*it)->getNick() == nick)
+			{
+				delete *it;
+				it = users.erase(it);
+			}
+			else
+			{
+				if(m.getCommand().empty() == false)
+					(*it)->getNick()->send(m);
+				++it;
+			}
+	}
+
+	class User : public Nick
+	{
+	public:
+		unsigned long received;
+
+		User(Server* server) : Nick(server, "romain"), received(0) {}
+		virtual void send(Message m)
+		{
+			string buf;
+			m.format(buf);
+			received++;
+		}
+	};
+
+	static unsigned long netsplit(unsigned long count, double& start)
+	{
+		Server server, own;
+		Channel chan;
+		User user(&own);
+		std::map<string, Nick*> users;
+		char name[32];
+
+		user.join(&chan);
+		for(unsigned long i = 0; i < count; ++i)
+		{
+			snprintf(name, sizeof name, "buddy%lu", i);
+			Nick* n = new Nick(&server, name);
+			server.addNick(n);
+			n->join(&chan);
+			users[name] = n;
+		}
+
+		/* IRC::removeServer() */
+		start = now();
+		for(std::map<string, Nick*>::iterator nt = users.begin(); nt != users.end();)
+			if(nt->second->getServer() == &server)
+			{
+				server.removeNick(nt->second);
+				delete nt->second;
+				users.erase(nt);
+				nt = users.begin();
+			}
+			else
+				++nt;
+
+		unsigned long received = user.received;
+		user.quit("bye");
+		return received;
+	}
+};
+
+static vector<Nick*> populate(Server* server, Channel* chan, BenchUser* user, unsigned long count)
+{
+	vector<Nick*> nicks;
+	vector<std::pair<Nick*, int> > members;
+	char name[32];
+
+	user->listening = false;
+	for(unsigned long i = 0; i < count; ++i)
+	{
+		snprintf(name, sizeof name, "buddy%lu", i);
+		Nick* n = new Nick(server, name, name, "bench.minbif");
+		server->addNick(n);
+		nicks.push_back(n);
+		members.push_back(std::pair<Nick*, int>(n, 0));
+	}
+	chan->addUsers(members);
+	user->listening = true;
+	user->received = 0;
+
+	return nicks;
+}
+
+static void report(const char* name, double start, unsigned long count, unsigned long received)
+{
+	double t = now() - start;
+	printf("%-24s %8lu nicks  %10.3f ms  (%lu QUITs)\n", name, count, t * 1e3, received);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long count = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+	BenchServer server;
+	BenchChannel chan;
+	BenchUser user(&server);
+	vector<Nick*> nicks;
+	double start;
+
+	chan.addUser(&user);
+
+	/* Previous implementation. */
+	unsigned long received = legacy::netsplit(count, start);
+	report("previous removeServer", start, count, received);
+
+	/* Netsplit: channels are purged once. */
+	nicks = populate(&server, &chan, &user, count);
+	start = now();
+	Nick::quitAll(nicks, "*.net *.split");
+	for(vector<Nick*>::iterator it = nicks.begin(); it != nicks.end(); ++it)
+	{
+		server.removeNick(*it);
+		delete *it;
+	}
+	report("Nick::quitAll", start, count, user.received);
+
+	user.listening = false;
+	return 0;
+}
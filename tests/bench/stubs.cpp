@@ -0,0 +1,42 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009-2010 Romain Bignon, Marc Dequènes (Duck)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Symbols used by RemoteServer and by NAMES replies, which benchmarks
+ * never reach: the IRC server and the libpurple accounts layer aren't
+ * linked. */
+
+#include <cstdlib>
+
+#include "irc/irc.h"
+#include "im/account.h"
+#include "im/buddy.h"
+#include "im/protocol.h"
+
+namespace irc
+{
+	void IRC::removeServer(string) { abort(); }
+	Nick* IRC::getNick(const string&, bool) const { abort(); }
+};
+
+namespace im
+{
+	string Account::getServername() const { abort(); }
+	irc::StatusChannel* Account::getStatusChannel() const { abort(); }
+	void Buddy::updated(vector<std::pair<irc::Nick*, int> >*) const { abort(); }
+	string Protocol::getName() const { abort(); }
+};
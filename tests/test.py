@@ -185,6 +185,7 @@ class Instance:
                     'irc':  {'hostname': 'im.symlink.me',
                              'type':  0,
                              'ping':  0,
+                             'who_max_results': 0,
                             },
                     'file_transfers': {'enabled': 'true',
                                        'dcc': 'true',
@@ -423,6 +424,8 @@ class Instance:
         while 1:
             msg = self.readmsg(('352', '315'), 3)
             if not msg or msg.cmd == '315':
+                if msg and 'truncated' in msg.args[1]:
+                    self.log('WHO %s: %s' % (accname, msg.args[1]))
                 return buddies
 
             servername = msg.args[3]
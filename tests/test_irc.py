@@ -0,0 +1,103 @@
+# -*- coding: utf-8 -*-
+
+"""
+Minbif - IRC instant messaging gateway
+Copyright(C) 2009 Romain Bignon
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+"""
+
+import sys
+
+from test import Test, Instance
+
+class TestIRC(Test):
+    NAME = 'irc'
+    # Only the user and the buddy icon nick exist without any account.
+    INSTANCES = {'minbif1': Instance({'irc': {'who_max_results': 1}})}
+    TESTS = ['isupport', 'privmsg_targets', 'too_many_targets',
+             'who_truncated', 'init', 'who_channel']
+
+    def test_isupport(self):
+        while 1:
+            msg = self['minbif1'].readmsg('005', 2)
+            if not msg:
+                return False
+            if 'MAXTARGETS=4' in msg.args:
+                return True
+
+    def test_privmsg_targets(self):
+        while self['minbif1'].readline(): pass
+
+        self['minbif1'].write('PRIVMSG minbif,minbif :hello world')
+        for i in xrange(2):
+            msg = self['minbif1'].readmsg('PRIVMSG', 2)
+            if not msg or msg.receiver != 'minbif' or msg.args[0] != 'hello world':
+                return False
+        return True
+
+    def test_too_many_targets(self):
+        while self['minbif1'].readline(): pass
+
+        self['minbif1'].write('PRIVMSG minbif,minbif,minbif,minbif,minbif :hello')
+        received = 0
+        while 1:
+            msg = self['minbif1'].readmsg(('PRIVMSG', '407'), 2)
+            if not msg:
+                return False
+            if msg.cmd == '407':
+                return received == 4 and msg.args[0] == 'minbif'
+            received += 1
+
+    def test_init(self):
+        if not self['minbif1'].create_account('jabber', channel='&minbif'): return False
+        if not self['minbif1'].wait_connected('jabber'): return False
+
+        return True
+
+    def test_who_channel(self):
+        while self['minbif1'].readline(): pass
+
+        self['minbif1'].write('WHO &minbif')
+        replies = []
+        while 1:
+            msg = self['minbif1'].readmsg(('352', '315'), 2)
+            if not msg:
+                return False
+            # Listing a channel is never truncated.
+            if msg.cmd == '315':
+                return 'minbif' in replies and msg.args[1] == 'End of /WHO list'
+            if msg.args[0] != '&minbif':
+                return False
+            replies.append(msg.args[4])
+
+    def test_who_truncated(self):
+        while self['minbif1'].readline(): pass
+
+        self['minbif1'].write('WHO *')
+        replies = 0
+        while 1:
+            msg = self['minbif1'].readmsg(('352', '315'), 2)
+            if not msg:
+                return False
+            if msg.cmd == '315':
+                return replies == 1 and 'truncated' in msg.args[1]
+            replies += 1
+
+if __name__ == '__main__':
+    test = TestIRC()
+    if test.run():
+        sys.exit(0)
+    else:
+        sys.exit(1)